@@ -19,36 +19,537 @@ The above copyright notice and this permission notice shall be included in
     OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
     THE SOFTWARE.
 */
+#ifdef _MSC_VER
 #include "StdAfx.h"
+#endif
 #include "RtfCpp.h"
-#include <iostream>
-#include <sstream>
 
-RtfWriter::RtfWriter(const std::wstring& filename): _rtfFile(NULL), _filename(filename)
+// RTF control words indexed by the RTF_* defines in rtfdefs.h
+
+// Paragraph break control words
+static constexpr std::string_view rtfParagraphBreakNames[] =
+{
+    "",                     // RTF_PARAGRAPHBREAK_NONE
+    "\\page",               // RTF_PARAGRAPHBREAK_PAGE
+    "\\column",             // RTF_PARAGRAPHBREAK_COLUMN
+    "\\line",               // RTF_PARAGRAPHBREAK_LINE
+};
+
+// Paragraph aligment control words
+static constexpr std::string_view rtfParagraphAlignNames[] =
+{
+    "\\ql",                 // RTF_PARAGRAPHALIGN_LEFT
+    "\\qc",                 // RTF_PARAGRAPHALIGN_CENTER
+    "\\qr",                 // RTF_PARAGRAPHALIGN_RIGHT
+    "\\qj",                 // RTF_PARAGRAPHALIGN_JUSTIFY
+};
+
+// Paragraph tab kind control words
+static constexpr std::string_view rtfTabKindNames[] =
+{
+    "",                     // RTF_PARAGRAPHTABKIND_NONE
+    "\\tqc",                // RTF_PARAGRAPHTABKIND_CENTER
+    "\\tqr",                // RTF_PARAGRAPHTABKIND_RIGHT
+    "\\tqdec",              // RTF_PARAGRAPHTABKIND_DECIMAL
+};
+
+// Paragraph tab leader control words
+static constexpr std::string_view rtfTabLeadNames[] =
+{
+    "",                     // RTF_PARAGRAPHTABLEAD_NONE
+    "\\tldot",              // RTF_PARAGRAPHTABLEAD_DOT
+    "\\tlmdot",             // RTF_PARAGRAPHTABLEAD_MDOT
+    "\\tlhyph",             // RTF_PARAGRAPHTABLEAD_HYPH
+    "\\tlul",               // RTF_PARAGRAPHTABLEAD_UNDERLINE
+    "\\tlth",               // RTF_PARAGRAPHTABLEAD_THICKLINE
+    "\\tleq",               // RTF_PARAGRAPHTABLEAD_EQUAL
+};
+
+// Paragraph border kind control words
+static constexpr std::string_view rtfBorderKindNames[] =
+{
+    "",                     // RTF_PARAGRAPHBORDERKIND_NONE
+    "\\brdrt",              // RTF_PARAGRAPHBORDERKIND_TOP
+    "\\brdrb",              // RTF_PARAGRAPHBORDERKIND_BOTTOM
+    "\\brdrl",              // RTF_PARAGRAPHBORDERKIND_LEFT
+    "\\brdrr",              // RTF_PARAGRAPHBORDERKIND_RIGHT
+    "\\box",                // RTF_PARAGRAPHBORDERKIND_BOX
+};
+
+// Border type control words
+static constexpr std::string_view rtfBorderTypeNames[] =
+{
+    "\\brdrs",              // RTF_PARAGRAPHBORDERTYPE_STHICK
+    "\\brdrth",             // RTF_PARAGRAPHBORDERTYPE_DTHICK
+    "\\brdrsh",             // RTF_PARAGRAPHBORDERTYPE_SHADOW
+    "\\brdrdb",             // RTF_PARAGRAPHBORDERTYPE_DOUBLE
+    "\\brdrdot",            // RTF_PARAGRAPHBORDERTYPE_DOT
+    "\\brdrdash",           // RTF_PARAGRAPHBORDERTYPE_DASH
+    "\\brdrhair",           // RTF_PARAGRAPHBORDERTYPE_HAIRLINE
+    "\\brdrinset",          // RTF_PARAGRAPHBORDERTYPE_INSET
+    "\\brdrdashsm",         // RTF_PARAGRAPHBORDERTYPE_SDASH
+    "\\brdrdashd",          // RTF_PARAGRAPHBORDERTYPE_DOTDASH
+    "\\brdrdashdd",         // RTF_PARAGRAPHBORDERTYPE_DOTDOTDASH
+    "\\brdroutset",         // RTF_PARAGRAPHBORDERTYPE_OUTSET
+    "\\brdrtriple",         // RTF_PARAGRAPHBORDERTYPE_TRIPLE
+    "\\brdrwavy",           // RTF_PARAGRAPHBORDERTYPE_WAVY
+    "\\brdrwavydb",         // RTF_PARAGRAPHBORDERTYPE_DWAVY
+    "\\brdrdashdotstr",     // RTF_PARAGRAPHBORDERTYPE_STRIPED
+    "\\brdremboss",         // RTF_PARAGRAPHBORDERTYPE_EMBOSS
+    "\\brdrengrave",        // RTF_PARAGRAPHBORDERTYPE_ENGRAVE
+};
+
+// Paragraph shading pattern control words
+static constexpr std::string_view rtfParagraphShadingNames[] =
+{
+    "",                     // RTF_PARAGRAPHSHADINGTYPE_FILL
+    "\\bghoriz",            // RTF_PARAGRAPHSHADINGTYPE_HORIZ
+    "\\bgvert",             // RTF_PARAGRAPHSHADINGTYPE_VERT
+    "\\bgfdiag",            // RTF_PARAGRAPHSHADINGTYPE_FDIAG
+    "\\bgbdiag",            // RTF_PARAGRAPHSHADINGTYPE_BDIAG
+    "\\bgcross",            // RTF_PARAGRAPHSHADINGTYPE_CROSS
+    "\\bgdcross",           // RTF_PARAGRAPHSHADINGTYPE_CROSSD
+    "\\bgdkhoriz",          // RTF_PARAGRAPHSHADINGTYPE_DHORIZ
+    "\\bgdkvert",           // RTF_PARAGRAPHSHADINGTYPE_DVERT
+    "\\bgdkfdiag",          // RTF_PARAGRAPHSHADINGTYPE_DFDIAG
+    "\\bgdkbdiag",          // RTF_PARAGRAPHSHADINGTYPE_DBDIAG
+    "\\bgdkcross",          // RTF_PARAGRAPHSHADINGTYPE_DCROSS
+    "\\bgdkdcross",         // RTF_PARAGRAPHSHADINGTYPE_DCROSSD
+};
+
+// Table cell shading pattern control words
+static constexpr std::string_view rtfCellShadingNames[] =
+{
+    "",                     // RTF_CELLSHADINGTYPE_FILL
+    "\\clbghoriz",          // RTF_CELLSHADINGTYPE_HORIZ
+    "\\clbgvert",           // RTF_CELLSHADINGTYPE_VERT
+    "\\clbgfdiag",          // RTF_CELLSHADINGTYPE_FDIAG
+    "\\clbgbdiag",          // RTF_CELLSHADINGTYPE_BDIAG
+    "\\clbgcross",          // RTF_CELLSHADINGTYPE_CROSS
+    "\\clbgdcross",         // RTF_CELLSHADINGTYPE_CROSSD
+    "\\clbgdkhoriz",        // RTF_CELLSHADINGTYPE_DHORIZ
+    "\\clbgdkvert",         // RTF_CELLSHADINGTYPE_DVERT
+    "\\clbgdkfdiag",        // RTF_CELLSHADINGTYPE_DFDIAG
+    "\\clbgdkbdiag",        // RTF_CELLSHADINGTYPE_DBDIAG
+    "\\clbgdkcross",        // RTF_CELLSHADINGTYPE_DCROSS
+    "\\clbgdkdcross",       // RTF_CELLSHADINGTYPE_DCROSSD
+};
+
+// Character underline control words
+static constexpr std::string_view rtfUnderlineNames[] =
+{
+    "\\ulnone",             // None underline
+    "\\ul",                 // Continuous underline
+    "\\uld",                // Dotted underline
+    "\\uldash",             // Dashed underline
+    "\\uldashd",            // Dash-dotted underline
+    "\\uldashdd",           // Dash-dot-dotted underline
+    "\\uldb",               // Double underline
+    "\\ulhwave",            // Heavy wave underline
+    "\\ulldash",            // Long dashed underline
+    "\\ulth",               // Thick underline
+    "\\ulthd",              // Thick dotted underline
+    "\\ulthdash",           // Thick dashed underline
+    "\\ulthdashd",          // Thick dash-dotted underline
+    "\\ulthdashdd",         // Thick dash-dot-dotted underline
+    "\\ulthldash",          // Thick long dashed underline
+    "\\ululdbwave",         // Double wave underline
+    "\\ulw",                // Word underline
+    "\\ulwave",             // Wave underline
+};
+
+// Font family control words
+static constexpr std::string_view rtfFontFamilyNames[] =
+{
+    "\\fnil",                // RTF_FONTFAMILY_NIL
+    "\\froman",              // RTF_FONTFAMILY_ROMAN
+    "\\fswiss",              // RTF_FONTFAMILY_SWISS
+    "\\fmodern",             // RTF_FONTFAMILY_MODERN
+    "\\fscript",             // RTF_FONTFAMILY_SCRIPT
+    "\\fdecor",              // RTF_FONTFAMILY_DECOR
+    "\\ftech",               // RTF_FONTFAMILY_TECH
+    "\\fbidi",               // RTF_FONTFAMILY_BIDI
+};
+
+// Section break control words
+static constexpr std::string_view rtfSectionBreakNames[] =
+{
+    "\\sbknone",            // RTF_SECTIONBREAK_CONTINUOUS
+    "\\sbkcol",             // RTF_SECTIONBREAK_COLUMN
+    "\\sbkpage",            // RTF_SECTIONBREAK_PAGE
+    "\\sbkeven",            // RTF_SECTIONBREAK_EVENPAGE
+    "\\sbkodd",             // RTF_SECTIONBREAK_ODDPAGE
+};
+
+// Table row aligment control words
+static constexpr std::string_view rtfRowAlignNames[] =
+{
+    "\\trql",               // RTF_ROWTEXTALIGN_LEFT
+    "\\trqc",               // RTF_ROWTEXTALIGN_CENTER
+    "\\trqr",               // RTF_ROWTEXTALIGN_RIGHT
+};
+
+// Table cell vertical aligment control words
+static constexpr std::string_view rtfCellAlignNames[] =
+{
+    "\\clvertalt",          // RTF_CELLTEXTALIGN_TOP
+    "\\clvertalc",          // RTF_CELLTEXTALIGN_CENTER
+    "\\clvertalb",          // RTF_CELLTEXTALIGN_BOTTOM
+};
+
+// Table cell text direction control words
+static constexpr std::string_view rtfCellDirectionNames[] =
+{
+    "\\cltxlrtb",           // RTF_CELLTEXTDIRECTION_LRTB
+    "\\cltxtbrl",           // RTF_CELLTEXTDIRECTION_RLTB
+    "\\cltxbtlr",           // RTF_CELLTEXTDIRECTION_LRBT
+    "\\cltxlrtbv",          // RTF_CELLTEXTDIRECTION_LRTBV
+    "\\cltxtbrlv",          // RTF_CELLTEXTDIRECTION_RLTBV
+};
+
+// Looks up control word, unknown values map to no control word
+template<size_t N>
+static constexpr std::string_view rtf_lookup(const std::string_view (&names)[N], int index)
+{
+    return ( index >= 0 && (size_t)index < N ) ? names[index] : std::string_view("");
+}
+
+// Font and color table references
+#define RTF_TABLEWORD_NONE		-1
+#define RTF_TABLEWORD_FONT		0
+#define RTF_TABLEWORD_COLOR		1
+
+// Classifies control word referencing the font or color table
+static int rtf_tableword(std::string_view word)
+{
+    if ( word == "f" )
+        return RTF_TABLEWORD_FONT;
+    if ( word == "cf" || word == "cb" || word == "cfpat" || word == "cbpat" || word == "clcfpat" ||
+         word == "clcbpat" || word == "brdrcf" || word == "chcfpat" || word == "chcbpat" || word == "highlight" )
+        return RTF_TABLEWORD_COLOR;
+    return RTF_TABLEWORD_NONE;
+}
+
+// Calls visit(kind, start, end, value) for every font and color reference, start and end delimit the number
+template<class Visit>
+static void rtf_visit_tablewords(std::string_view text, Visit visit)
+{
+    size_t size = text.size();
+    size_t i = text.find( '\\' );
+    while ( i != std::string_view::npos && i + 1 < size )
+    {
+        // Control symbols, including escaped backslashes, are skipped
+        size_t word = i + 1;
+        size_t end = word;
+        while ( end < size && ( ( text[end] >= 'a' && text[end] <= 'z' ) || ( text[end] >= 'A' && text[end] <= 'Z' ) ) )
+            end++;
+        if ( end == word )
+        {
+            i = text.find( '\\', word + 1 );
+            continue;
+        }
+
+        size_t digits = end;
+        unsigned long value = 0;
+        while ( digits < size && text[digits] >= '0' && text[digits] <= '9' )
+            value = value * 10 + ( text[digits++] - '0' );
+
+        int kind = ( digits > end ) ? rtf_tableword( text.substr( word, end - word ) ) : RTF_TABLEWORD_NONE;
+        if ( kind != RTF_TABLEWORD_NONE )
+            visit( kind, end, digits, value );
+
+        i = text.find( '\\', digits );
+    }
+}
+
+// Builds font registry key from name, family and character set
+static std::string rtf_font_key(std::string_view name, int family, int charset)
+{
+    std::string key( name );
+    key += '\0';
+    key += std::to_string( family );
+    key += ',';
+    key += std::to_string( charset );
+    return key;
+}
+
+#ifndef _WIN32
+// Converts wide file name to UTF-8 path
+static std::string rtf_narrow_path(const std::wstring& name)
+{
+    std::string path;
+    path.reserve( name.size() );
+    for ( wchar_t wc : name )
+    {
+        unsigned long cp = (unsigned long)wc;
+        if ( cp < 0x80 )
+            path += (char)cp;
+        else if ( cp < 0x800 )
+        {
+            path += (char)( 0xc0 | ( cp >> 6 ) );
+            path += (char)( 0x80 | ( cp & 0x3f ) );
+        }
+        else if ( cp < 0x10000 )
+        {
+            path += (char)( 0xe0 | ( cp >> 12 ) );
+            path += (char)( 0x80 | ( ( cp >> 6 ) & 0x3f ) );
+            path += (char)( 0x80 | ( cp & 0x3f ) );
+        }
+        else
+        {
+            path += (char)( 0xf0 | ( cp >> 18 ) );
+            path += (char)( 0x80 | ( ( cp >> 12 ) & 0x3f ) );
+            path += (char)( 0x80 | ( ( cp >> 6 ) & 0x3f ) );
+            path += (char)( 0x80 | ( cp & 0x3f ) );
+        }
+    }
+    return path;
+}
+#endif
+
+// Checks paragraphs share tabs, numbering, borders and shading
+static bool rtf_same_blocks(const RTF_PARAGRAPH_FORMAT& a, const RTF_PARAGRAPH_FORMAT& b)
+{
+    if ( a.paragraphTabs != b.paragraphTabs || a.paragraphNums != b.paragraphNums ||
+         a.paragraphBorders != b.paragraphBorders || a.paragraphShading != b.paragraphShading )
+        return false;
+
+    if ( a.paragraphTabs && ( a.TABS.tabPosition != b.TABS.tabPosition || a.TABS.tabKind != b.TABS.tabKind ||
+         a.TABS.tabLead != b.TABS.tabLead ) )
+        return false;
+
+    if ( a.paragraphNums && ( a.NUMS.numsLevel != b.NUMS.numsLevel || a.NUMS.numsSpace != b.NUMS.numsSpace ||
+         a.NUMS.numsChar != b.NUMS.numsChar ) )
+        return false;
+
+    if ( a.paragraphBorders && ( a.BORDERS.borderKind != b.BORDERS.borderKind || a.BORDERS.borderType != b.BORDERS.borderType ||
+         a.BORDERS.borderWidth != b.BORDERS.borderWidth || a.BORDERS.borderColor != b.BORDERS.borderColor ||
+         a.BORDERS.borderSpace != b.BORDERS.borderSpace ) )
+        return false;
+
+    if ( a.paragraphShading && ( a.SHADING.shadingIntensity != b.SHADING.shadingIntensity || a.SHADING.shadingType != b.SHADING.shadingType ||
+         a.SHADING.shadingFillColor != b.SHADING.shadingFillColor || a.SHADING.shadingBkColor != b.SHADING.shadingBkColor ) )
+        return false;
+
+    return true;
+}
+
+// Checks paragraphs share properties which can only be reset with \\pard
+static bool rtf_same_layout(const RTF_PARAGRAPH_FORMAT& a, const RTF_PARAGRAPH_FORMAT& b)
+{
+    if ( a.defaultParagraph != b.defaultParagraph || a.tableText != b.tableText )
+        return false;
+
+    return rtf_same_blocks( a, b );
+}
+
+// Reads big endian number from image header
+static unsigned long rtf_read_be(const unsigned char* data, int size)
+{
+    unsigned long value = 0;
+    for ( int i=0; i<size; i++ )
+        value = (value << 8) | data[i];
+    return value;
+}
+
+// Reads image type and pixel size from PNG or JPEG header
+static bool rtf_read_imageinfo(FILE* file, RTF_IMAGE_INFO& info)
+{
+    unsigned char header[24];
+    info.imageType = RTF_IMAGETYPE_NONE;
+
+    if ( fread( header, 1, 2, file ) != 2 )
+        return false;
+
+    // PNG signature is followed by the IHDR chunk
+    if ( header[0] == 0x89 && header[1] == 'P' )
+    {
+        if ( fread( header + 2, 1, 22, file ) != 22 || memcmp( header, "\x89PNG\r\n\x1a\n", 8 ) != 0 ||
+             memcmp( header + 12, "IHDR", 4 ) != 0 )
+            return false;
+
+        info.imageType = RTF_IMAGETYPE_PNG;
+        info.imageWidth = (int)rtf_read_be( header + 16, 4 );
+        info.imageHeight = (int)rtf_read_be( header + 20, 4 );
+        return info.imageWidth > 0 && info.imageHeight > 0;
+    }
+
+    // JPEG segments are walked up to the first start of frame marker
+    if ( header[0] != 0xFF || header[1] != 0xD8 )
+        return false;
+
+    while ( true )
+    {
+        int c = fgetc( file );
+        if ( c != 0xFF )
+            return false;
+        while ( c == 0xFF )
+            c = fgetc( file );
+        if ( c == EOF || c == 0xD9 || c == 0xDA )
+            return false;
+
+        // Standalone markers have no length
+        if ( c == 0x01 || ( c >= 0xD0 && c <= 0xD7 ) )
+            continue;
+
+        if ( fread( header, 1, 2, file ) != 2 )
+            return false;
+        long length = (long)rtf_read_be( header, 2 );
+        if ( length < 2 )
+            return false;
+
+        // SOF0..SOF15, except DHT, JPG and DAC
+        if ( c >= 0xC0 && c <= 0xCF && c != 0xC4 && c != 0xC8 && c != 0xCC )
+        {
+            if ( fread( header, 1, 5, file ) != 5 )
+                return false;
+
+            info.imageType = RTF_IMAGETYPE_JPEG;
+            info.imageHeight = (int)rtf_read_be( header + 1, 2 );
+            info.imageWidth = (int)rtf_read_be( header + 3, 2 );
+            return info.imageWidth > 0 && info.imageHeight > 0;
+        }
+
+        if ( fseek( file, length - 2, SEEK_CUR ) != 0 )
+            return false;
+    }
+}
+
+RtfWriter::RtfWriter(const std::wstring& filename): _filename(filename), _rtfTextEncoding(RTF_TEXTENCODING_ANSI), _rtfMinimalOutput(false), _rtfDeferredHeader(false), _rtfFileBackend(RTF_FILEBACKEND_DEFAULT), _rtfOpen(false), _rtfStateValid(false), _rtfParagraphStyle(0), _rtfLastStyle(0), _rtfFormatDepth(0), _rtfImageCache(NULL)
 {
+    // Fonts, colors and styles may be registered before open()
+    set_defaulttables();
+    set_defaultformat();
+}
+
+RtfWriter::RtfWriter(std::unique_ptr<RtfSink> sink): _rtfTextEncoding(RTF_TEXTENCODING_ANSI), _rtfMinimalOutput(false), _rtfDeferredHeader(false), _rtfFileBackend(RTF_FILEBACKEND_DEFAULT), _rtfOpen(false), _rtfStateValid(false), _rtfParagraphStyle(0), _rtfLastStyle(0), _rtfFormatDepth(0), _rtfImageCache(NULL), _rtfSink(std::move(sink))
+{
+    // Fonts, colors and styles may be registered before open()
+    set_defaulttables();
+    set_defaultformat();
+}
 
+RtfWriter::RtfWriter(const RtfDocumentProfile& profile, std::unique_ptr<RtfSink> sink): _rtfFileBackend(RTF_FILEBACKEND_DEFAULT), _rtfOpen(false), _rtfStateValid(false), _rtfFormatDepth(0), _rtfImageCache(NULL), _rtfSink(std::move(sink))
+{
+    // Tables and formatting are taken over from the profile, failure leaves get_sink() NULL or not good()
+    open( profile );
 }
 
 RtfWriter::~RtfWriter()
 {
-    if(_rtfFile)
+    if(_rtfOpen)
+        write_documentend();
+}
+
+
+// Completes and closes RTF document
+bool RtfWriter::write_documentend()
+{
+    // Close format groups left open, formatting is restored for the next document
+    if ( _rtfFormatDepth > 0 )
     {
-        // Write RTF document end part
-        std::string rtfText ("\n\\par}");
-        fwrite(rtfText.c_str(), 1, rtfText.length(), _rtfFile );
+        memcpy( &_rtfParFormat, &_rtfFormatStack[0].format, sizeof(RTF_PARAGRAPH_FORMAT) );
+        _rtfParagraphStyle = _rtfFormatStack[0].style;
+    }
+    for ( ; _rtfFormatDepth > 0; _rtfFormatDepth-- )
+        _rtfSink->put( '}' );
 
-        // Close RTF document
-        fclose(_rtfFile);
+    // Write RTF document end part
+    _rtfSink->write("\n\\par}");
+
+    // Buffered body goes to the document after its header
+    bool result = true;
+    if ( _rtfTarget )
+    {
+        _rtfSink = std::move( _rtfTarget );
+        result = write_deferred();
     }
+
+    // Close RTF document
+    if ( !_rtfSink->close() )
+        result = false;
+    _rtfOpen = false;
+
+    // Return error flag
+    return result;
 }
 
-bool RtfWriter::open(char* fonts, char* colors)
+
+// Writes header with used fonts and colors only, followed by the renumbered body
+bool RtfWriter::write_deferred()
 {
-    // Set error flag
-    int error = RTF_SUCCESS;
+    // Fonts and colors are numbered in order of first use, the default font stays first
+    const RtfTables& tables = *_rtfTables;
+    std::vector<int> fontMap( tables.fonts.size(), -1 );
+    std::vector<int> colorMap( tables.colors.size(), -1 );
+    std::vector<int> fontOrder;
+    std::vector<int> colorOrder;
+    if ( !tables.fonts.empty() )
+    {
+        fontMap[0] = 0;
+        fontOrder.push_back( 0 );
+    }
+
+    auto assign = [&](int kind, size_t, size_t, unsigned long value)
+    {
+        std::vector<int>& map = ( kind == RTF_TABLEWORD_FONT ) ? fontMap : colorMap;
+        std::vector<int>& order = ( kind == RTF_TABLEWORD_FONT ) ? fontOrder : colorOrder;
+        if ( value < map.size() && map[value] < 0 )
+        {
+            map[value] = (int)order.size();
+            order.push_back( (int)value );
+        }
+    };
+    rtf_visit_tablewords( tables.styleSheet, assign );
+    rtf_visit_tablewords( _rtfBody, assign );
+
+    // Renumbers table references while copying text
+    auto renumber = [&](RtfSink& sink, std::string_view text)
+    {
+        size_t done = 0;
+        rtf_visit_tablewords( text, [&](int kind, size_t start, size_t end, unsigned long value)
+        {
+            const std::vector<int>& map = ( kind == RTF_TABLEWORD_FONT ) ? fontMap : colorMap;
+            if ( value >= map.size() )
+                return;
+            sink.write( text.substr( done, start - done ) );
+            sink.write_int( map[value] );
+            done = end;
+        });
+        sink.write( text.substr( done ) );
+    };
+
+    std::string fonts;
+    std::string colors;
+    std::string styles;
+    {
+        RtfStringSink fontSink( fonts );
+        for ( size_t i=0; i<fontOrder.size(); i++ )
+            write_fontentry( fontSink, (int)i, tables.fonts[fontOrder[i]] );
+
+        RtfStringSink colorSink( colors );
+        for ( size_t i=0; i<colorOrder.size(); i++ )
+            write_colorentry( colorSink, tables.colors[colorOrder[i]] );
+
+        RtfStringSink styleSink( styles );
+        renumber( styleSink, tables.styleSheet );
+    }
+
+    write_header( *_rtfSink, fonts, colors, styles );
+    renumber( *_rtfSink, _rtfBody );
+
+    // Return error flag
+    return _rtfSink->good();
+}
 
-    // Initialize global params
-    init();
+bool RtfWriter::open(const char* fonts, const char* colors)
+{
+    // A started document is completed by reset first
+    if ( _rtfOpen )
+        return false;
+
+    // Initialize formatting, registered fonts, colors and styles are kept
+    set_defaultformat();
 
     // Set RTF document font table
     if ( fonts != NULL )
@@ -64,17 +565,29 @@ bool RtfWriter::open(char* fonts, char* colors)
             set_colortable(colors);
     }
 
-    // Create RTF document
-    char* filename = NULL;
-    errno_t isOk = _wfopen_s(&_rtfFile, _filename.c_str(), L"w");
-    if(isOk != 0)
+    return reopen();
+}
+
+
+// Starts next RTF document with current tables and formatting. The document goes to
+// the sink attached by reset, only the first document goes to the file of the writer
+bool RtfWriter::reopen()
+{
+    // Set error flag
+    int error = RTF_SUCCESS;
+
+    // Completed documents are never overwritten, the next one needs its own sink
+    if ( _rtfOpen || ( !_rtfSink && _filename.empty() ) )
         return false;
-    //_rtfFile = fopen(filename, "w" );
 
-    if ( _rtfFile != NULL )
+    _rtfStateValid = false;
+    _rtfLastStyle = 0;
+    memcpy( &_rtfRunFormat, &_rtfParFormat.CHARACTER, sizeof(RTF_CHARACTER_FORMAT) );
+
+    if ( start_document() )
     {
-        // Write RTF document header
-        if ( !write_header() )
+        // Write RTF document header, unless buffering the body until used fonts and colors are known
+        if ( !_rtfDeferredHeader && !write_header() )
             error = RTF_HEADER_ERROR;
 
         // Write RTF document formatting properties
@@ -91,63 +604,220 @@ bool RtfWriter::open(char* fonts, char* colors)
     return error == RTF_SUCCESS;
 }
 
+
+// Completes current document and attaches the sink of the next document. Tables,
+// formatting, registered formats and grown buffers are kept for the next document.
+// The completed sink is closed and kept only until the next one takes over its buffer.
+bool RtfWriter::reset(std::unique_ptr<RtfSink> sink)
+{
+    bool result = true;
+    if ( _rtfOpen )
+        result = write_documentend();
+
+    // Completed sink is kept until the next one can take over its buffer
+    if ( _rtfSink )
+        _rtfSpare = std::move( _rtfSink );
+    _rtfSink = std::move( sink );
+
+    return result;
+}
+
+
+// Opens RTF document with prologue pre-rendered by profile
+bool RtfWriter::open(const RtfDocumentProfile& profile)
+{
+    // A started document is completed by reset first, the next one needs its own sink
+    if ( _rtfOpen || ( !_rtfSink && _filename.empty() ) )
+        return false;
+
+    // Take over formatting, containers keep their capacity. Tables are shared until modified
+    memcpy( &_rtfDocFormat, &profile._rtfDocFormat, sizeof(RTF_DOCUMENT_FORMAT) );
+    memcpy( &_rtfSecFormat, &profile._rtfSecFormat, sizeof(RTF_SECTION_FORMAT) );
+    memcpy( &_rtfParFormat, &profile._rtfParFormat, sizeof(RTF_PARAGRAPH_FORMAT) );
+    memcpy( &_rtfRowFormat, &profile._rtfRowFormat, sizeof(RTF_TABLEROW_FORMAT) );
+    memcpy( &_rtfCellFormat, &profile._rtfCellFormat, sizeof(RTF_TABLECELL_FORMAT) );
+    _rtfTables = profile._rtfTables;
+    _rtfFormats = profile._rtfFormats;
+    _rtfTextEncoding = profile._rtfTextEncoding;
+    _rtfMinimalOutput = profile._rtfMinimalOutput;
+    _rtfDeferredHeader = profile._rtfDeferredHeader;
+    _rtfParagraphStyle = profile._rtfParagraphStyle;
+    _rtfLastStyle = 0;
+    _rtfStateValid = false;
+    memcpy( &_rtfRunFormat, &_rtfParFormat.CHARACTER, sizeof(RTF_CHARACTER_FORMAT) );
+
+    if ( !start_document() )
+        return false;
+
+    // Header, document and section formatting in one block
+    return _rtfSink->write( profile._rtfPrologue );
+}
+
+
+// Captures tables and formatting as reusable document profile
+std::shared_ptr<const RtfDocumentProfile> RtfWriter::create_profile()
+{
+    std::shared_ptr<RtfDocumentProfile> profile( new RtfDocumentProfile() );
+    memcpy( &profile->_rtfDocFormat, &_rtfDocFormat, sizeof(RTF_DOCUMENT_FORMAT) );
+    memcpy( &profile->_rtfSecFormat, &_rtfSecFormat, sizeof(RTF_SECTION_FORMAT) );
+    memcpy( &profile->_rtfParFormat, &_rtfParFormat, sizeof(RTF_PARAGRAPH_FORMAT) );
+    memcpy( &profile->_rtfRowFormat, &_rtfRowFormat, sizeof(RTF_TABLEROW_FORMAT) );
+    memcpy( &profile->_rtfCellFormat, &_rtfCellFormat, sizeof(RTF_TABLECELL_FORMAT) );
+    profile->_rtfTables = _rtfTables;
+    profile->_rtfFormats = _rtfFormats;
+    profile->_rtfTextEncoding = _rtfTextEncoding;
+    profile->_rtfMinimalOutput = _rtfMinimalOutput;
+    profile->_rtfDeferredHeader = _rtfDeferredHeader;
+    profile->_rtfParagraphStyle = _rtfParagraphStyle;
+
+    // Render the prologue, a deferred header is written when the document ends
+    {
+        RtfStringSink sink( profile->_rtfPrologue );
+        if ( !_rtfDeferredHeader )
+            write_header( sink, _rtfTables->fontTable, _rtfTables->colorTable, _rtfTables->styleSheet );
+        write_documentformat( sink );
+        write_sectionformat( sink );
+    }
+
+    return profile;
+}
+
+
+// Gets pre-rendered document prologue
+std::string_view RtfDocumentProfile::get_prologue() const
+{
+    return _rtfPrologue;
+}
+
+
+// Creates RTF document sink, buffers the body of deferred document
+bool RtfWriter::start_document()
+{
+    // Create RTF document, unless writing to a caller supplied sink
+    if ( !_rtfSink )
+    {
+#ifdef _WIN32
+        FILE* file = NULL;
+        errno_t isOk = _wfopen_s(&file, _filename.c_str(), L"w");
+        if(isOk != 0)
+            return false;
+
+        // Background I/O thread writes the file unbuffered
+        if ( _rtfFileBackend == RTF_FILEBACKEND_ASYNC )
+            _rtfSink.reset( new RtfAsyncSink( std::unique_ptr<RtfSink>( new RtfFileSink(file, true, 0) ) ) );
+        else
+            _rtfSink.reset( new RtfFileSink(file) );
+#else
+        std::string path = rtf_narrow_path( _filename );
+        if ( _rtfFileBackend == RTF_FILEBACKEND_MMAP )
+            _rtfSink = RtfMmapSink::create( path.c_str() );
+        else if ( _rtfFileBackend == RTF_FILEBACKEND_ASYNC )
+        {
+            // Background I/O thread writes the file unbuffered
+            std::unique_ptr<RtfSink> target = RtfPosixSink::create( path.c_str(), 0, 0, 0 );
+            if ( target )
+                _rtfSink.reset( new RtfAsyncSink( std::move(target) ) );
+        }
+        else
+            _rtfSink = RtfPosixSink::create( path.c_str() );
+        if ( !_rtfSink )
+            return false;
+#endif
+
+        // File of the writer receives the first document only
+        _filename.clear();
+    }
+
+    // Reuse buffer grown by the previous document
+    if ( _rtfSpare )
+    {
+        _rtfSink->reuse_buffer( *_rtfSpare );
+        _rtfSpare.reset();
+    }
+    _rtfOpen = true;
+
+    // Body is buffered until used fonts and colors are known
+    if ( _rtfDeferredHeader )
+    {
+        _rtfBody.clear();
+        _rtfTarget = std::move( _rtfSink );
+        _rtfSink.reset( new RtfStringSink( _rtfBody ) );
+    }
+
+    return true;
+}
+
+
 // Writes RTF document header
 bool RtfWriter::write_header()
 {
-    // Set error flag
-    bool result = true;
+    return write_header( *_rtfSink, _rtfTables->fontTable, _rtfTables->colorTable, _rtfTables->styleSheet );
+}
+
 
+// Writes RTF document header with given tables
+bool RtfWriter::write_header(RtfSink& sink, std::string_view fonts, std::string_view colors, std::string_view styles)
+{
     // Standard RTF document header
-    std::string rtfText;
-    rtfText += "{\\rtf1\\ansi\\ansicpg1252\\deff0{\\fonttbl";
-    rtfText += _rtfFontTable;
-    rtfText += "}{\\colortbl";
-    rtfText += _rtfColorTable;
-    rtfText += "}{\\*\\generator rtflib ver. 1.0;}";
-    rtfText += "\n{\\info{\\author rtflib ver. 1.0}{\\company ETC Company LTD.}}";
-
-    // Writes standard RTF document header part
-    if ( fwrite( rtfText.c_str(), 1, rtfText.length(), _rtfFile ) < rtfText.length() )
-        result = false;
+    sink.write( "{\\rtf1\\ansi\\ansicpg1252\\deff0{\\fonttbl" );
+    sink.write( fonts );
+    sink.write( "}{\\colortbl" );
+    sink.write( colors );
+    sink.put( '}' );
+    sink.write( styles );
+    sink.write( "{\\*\\generator rtflib ver. 1.0;}" );
+    sink.write( "\n{\\info{\\author rtflib ver. 1.0}{\\company ETC Company LTD.}}" );
 
     // Return error flag
-    return result;
+    return sink.good();
 }
 
 void RtfWriter::init()
 {
-    // Set RTF document default font table
-     _rtfFontTable.clear();
-    _rtfFontTable += "{\\f0\\froman\\fcharset0\\cpg1252 Times New Roman}";
-    _rtfFontTable += "{\\f1\\fswiss\\fcharset0\\cpg1252 Arial}";
-    _rtfFontTable += "{\\f2\\fmodern\\fcharset0\\cpg1252 Courier New}";
-    _rtfFontTable += "{\\f3\\fscript\\fcharset0\\cpg1252 Cursive}";
-    _rtfFontTable += "{\\f4\\fdecor\\fcharset0\\cpg1252 Old English}";
-    _rtfFontTable += "{\\f5\\ftech\\fcharset0\\cpg1252 Symbol}";
-    _rtfFontTable += "{\\f6\\fbidi\\fcharset0\\cpg1252 Miriam}";
-
-    // Set RTF document default color table
-    _rtfColorTable.clear();
-    _rtfColorTable += "\\red0\\green0\\blue0;" ;
-    _rtfColorTable += "\\red255\\green0\\blue0;" ;
-    _rtfColorTable += "\\red0\\green255\\blue0;" ;
-    _rtfColorTable += "\\red0\\green0\\blue255;" ;
-    _rtfColorTable += "\\red255\\green255\\blue0;" ;
-    _rtfColorTable += "\\red255\\green0\\blue255;" ;
-    _rtfColorTable += "\\red0\\green255\\blue255;" ;
-    _rtfColorTable += "\\red255\\green255\\blue255;" ;
-    _rtfColorTable += "\\red128\\green0\\blue0;" ;
-    _rtfColorTable += "\\red0\\green128\\blue0;" ;
-    _rtfColorTable += "\\red0\\green0\\blue128;" ;
-    _rtfColorTable += "\\red128\\green128\\blue0;" ;
-    _rtfColorTable += "\\red128\\green0\\blue128;" ;
-    _rtfColorTable += "\\red0\\green128\\blue128;" ;
-     _rtfColorTable += "\\red128\\green128\\blue128;" ;
+    // Set default font and color tables
+    set_defaulttables();
 
     // Set default formatting
     set_defaultformat();
 }
 
+// Sets default RTF document font and color tables
+void RtfWriter::set_defaulttables()
+{
+    // Set RTF document default font table
+    RtfTables& tables = edit_tables();
+    tables.fontTable.clear();
+    tables.fonts.clear();
+    tables.fontIndex.clear();
+    add_font( "Times New Roman", RTF_FONTFAMILY_ROMAN );
+    add_font( "Arial", RTF_FONTFAMILY_SWISS );
+    add_font( "Courier New", RTF_FONTFAMILY_MODERN );
+    add_font( "Cursive", RTF_FONTFAMILY_SCRIPT );
+    add_font( "Old English", RTF_FONTFAMILY_DECOR );
+    add_font( "Symbol", RTF_FONTFAMILY_TECH );
+    add_font( "Miriam", RTF_FONTFAMILY_BIDI );
+
+    // Set RTF document default color table
+    tables.colorTable.clear();
+    tables.colors.clear();
+    tables.colorIndex.clear();
+    add_color( 0, 0, 0 );
+    add_color( 255, 0, 0 );
+    add_color( 0, 255, 0 );
+    add_color( 0, 0, 255 );
+    add_color( 255, 255, 0 );
+    add_color( 255, 0, 255 );
+    add_color( 0, 255, 255 );
+    add_color( 255, 255, 255 );
+    add_color( 128, 0, 0 );
+    add_color( 0, 128, 0 );
+    add_color( 0, 0, 128 );
+    add_color( 128, 128, 0 );
+    add_color( 128, 0, 128 );
+    add_color( 0, 128, 128 );
+    add_color( 128, 128, 128 );
+}
+
 // Sets default RTF document formatting
 void RtfWriter::set_defaultformat()
 {
@@ -238,195 +908,326 @@ void RtfWriter::set_defaultformat()
 
 
 // Sets new RTF document font table
-void RtfWriter::set_fonttable( char* fonts )
+void RtfWriter::set_fonttable(const char* fonts)
 {
     // Clear old font table
-    _rtfFontTable =  "";
-
-    // Set separator list
-    char separator[] = ";";
-
-    // Create new RTF document font table
-    int font_number = 0;
-    char font_table_entry[1024];
-    char* token = strtok( fonts, separator );
-    while ( token != NULL )
+    RtfTables& tables = edit_tables();
+    tables.fontTable.clear();
+    tables.fonts.clear();
+    tables.fontIndex.clear();
+
+    // Fonts are separated by ';', table positions are kept even for repeated fonts
+    std::string_view list( fonts );
+    while ( !list.empty() )
     {
-        // Format font table entry
-        sprintf( font_table_entry, "{\\f%d\\fnil\\fcharset0\\cpg1252 %s}", font_number, token );
-        _rtfFontTable += font_table_entry;
-        //strcat( _rtfFontTable, font_table_entry );
-
-        // Get next font
-        token = strtok( NULL, separator );
-        font_number++;
+        size_t end = list.find( ';' );
+        std::string_view token = list.substr( 0, end );
+        list = ( end == std::string_view::npos ) ? std::string_view() : list.substr( end + 1 );
+        if ( token.empty() )
+            continue;
+
+        RtfFont font;
+        font.name = std::string( token );
+        font.family = RTF_FONTFAMILY_NIL;
+        font.charset = 0;
+        append_font( font );
     }
 }
 
 
 // Sets new RTF document color table
-void RtfWriter::set_colortable(char* colors)
+void RtfWriter::set_colortable(const char* colors)
 {
     // Clear old color table
-    _rtfColorTable.clear();
-    //strcpy( _rtfColorTable, "" );
-
-    // Set separator list
-    char separator[] = ";";
-
-    // Create new RTF document color table
-    int color_number = 0;
-    char color_table_entry[1024];
-    char* token = strtok( colors, separator );
-    while ( token != NULL )
-    {
-        // Red
-        sprintf( color_table_entry, "\\red%s", token );
-        _rtfColorTable += color_table_entry;
-        //strcat( _rtfColorTable, color_table_entry );
-
-        // Green
-        token = strtok( NULL, separator );
-        if ( token != NULL )
+    RtfTables& tables = edit_tables();
+    tables.colorTable.clear();
+    tables.colors.clear();
+    tables.colorIndex.clear();
+
+    // Colors are ';' separated red, green and blue triples, table positions are kept even for repeated colors
+    int rgb[3];
+    int component = 0;
+    const char* p = colors;
+    while ( *p != '\0' )
+    {
+        if ( *p == ';' )
         {
-            sprintf( color_table_entry, "\\green%s", token );
-            _rtfColorTable += color_table_entry;
-            //strcat( _rtfColorTable, color_table_entry );
+            p++;
+            continue;
         }
 
-        // Blue
-        token = strtok( NULL, separator );
-        if ( token != NULL )
+        char* end;
+        rgb[component++] = (int)strtol( p, &end, 10 );
+        p = ( end != p ) ? end : p + 1;
+        while ( *p != '\0' && *p != ';' )
+            p++;
+
+        if ( component == 3 )
         {
-            sprintf( color_table_entry, "\\blue%s;", token );
-            _rtfColorTable += color_table_entry;
-            //strcat( _rtfColorTable, color_table_entry );
+            append_color( ( (unsigned long)( rgb[0] & 0xff ) << 16 ) | ( ( rgb[1] & 0xff ) << 8 ) | ( rgb[2] & 0xff ) );
+            component = 0;
         }
-
-        // Get next color
-        token = strtok( NULL, separator );
-        color_number++;
     }
 }
 
 
-// Sets RTF document formatting properties
-void RtfWriter::set_documentformat(RTF_DOCUMENT_FORMAT* df)
+// Adds font to font table, returns its index. Repeated fonts return the existing index
+int RtfWriter::add_font(const char* name, int family, int charset)
 {
-    // Set new RTF document formatting properties
-    memcpy( &_rtfDocFormat, df, sizeof(RTF_DOCUMENT_FORMAT) );
+    auto it = _rtfTables->fontIndex.find( rtf_font_key( name, family, charset ) );
+    if ( it != _rtfTables->fontIndex.end() )
+        return it->second;
+
+    RtfFont font;
+    font.name = name;
+    font.family = family;
+    font.charset = charset;
+    return append_font( font );
 }
 
 
-// Writes RTF document formatting properties
-bool RtfWriter::write_documentformat()
+// Adds color to color table, returns its index. Repeated colors return the existing index
+int RtfWriter::add_color(int red, int green, int blue)
 {
-    // Set error flag
-    bool result = true;
+    unsigned long rgb = ( (unsigned long)( red & 0xff ) << 16 ) | ( ( green & 0xff ) << 8 ) | ( blue & 0xff );
 
-    // RTF document text
-    char rtfText[1024];
-    strcpy( rtfText, "" );
+    auto it = _rtfTables->colorIndex.find( rgb );
+    if ( it != _rtfTables->colorIndex.end() )
+        return it->second;
 
-    sprintf( rtfText, "\\viewkind%d\\viewscale%d\\paperw%d\\paperh%d\\margl%d\\margr%d\\margt%d\\margb%d\\gutter%d",
-        _rtfDocFormat.viewKind, _rtfDocFormat.viewScale, _rtfDocFormat.paperWidth, _rtfDocFormat.paperHeight,
-        _rtfDocFormat.marginLeft, _rtfDocFormat.marginRight, _rtfDocFormat.marginTop, _rtfDocFormat.marginBottom, _rtfDocFormat.gutterWidth );
-
-    if ( _rtfDocFormat.facingPages )
-        strcat( rtfText, "\\facingp" );
-    if ( _rtfDocFormat.readOnly )
-        strcat( rtfText, "\\annotprot" );
-
-    // Writes RTF document formatting properties
-    if ( fwrite( rtfText, 1, strlen(rtfText), _rtfFile ) < strlen(rtfText) )
-        result = false;
-
-    // Return error flag
-    return result;
+    return append_color( rgb );
 }
 
 
-// Sets RTF section formatting properties
-void RtfWriter::set_sectionformat(RTF_SECTION_FORMAT* sf)
+// Gets tables for modification, tables shared with a profile or its writers are copied first
+RtfWriter::RtfTables& RtfWriter::edit_tables()
 {
-    // Set new RTF section formatting properties
-    memcpy( &_rtfSecFormat, sf, sizeof(RTF_SECTION_FORMAT) );
+    if ( !_rtfTables )
+        _rtfTables = std::make_shared<RtfTables>();
+    else if ( _rtfTables.use_count() > 1 )
+        _rtfTables = std::make_shared<RtfTables>( *_rtfTables );
+
+    // Not shared, the tables were created by a writer as modifiable
+    return const_cast<RtfTables&>( *_rtfTables );
 }
 
 
-// Writes RTF section formatting properties
-bool RtfWriter::write_sectionformat()
+// Appends font table entry
+int RtfWriter::append_font(const RtfFont& font)
 {
-    // Set error flag
-    bool result = true;
+    RtfTables& tables = edit_tables();
+    int number = (int)tables.fonts.size();
+    tables.fonts.push_back( font );
 
-    // RTF document text
-    char rtfText[1024];
-    strcpy( rtfText, "" );
+    tables.fontIndex.emplace( rtf_font_key( font.name, font.family, font.charset ), number );
 
-    // Format new section
-    char text[1024]="", pgn[100]="";
-    if ( _rtfSecFormat.newSection )
-        strcat( text, "\\sect" );
-    if ( _rtfSecFormat.defaultSection )
-        strcat( text, "\\sectd" );
-    if ( _rtfSecFormat.showPageNumber )
-    {
-        sprintf( pgn, "\\pgnx%d\\pgny%d", _rtfSecFormat.pageNumberOffsetX, _rtfSecFormat.pageNumberOffsetY );
-        strcat( text, pgn );
-    }
+    // Format font table entry
+    RtfStringSink sink( tables.fontTable );
+    write_fontentry( sink, number, font );
 
-    // Format section break
-    char sbr[100] = "";
-    switch (_rtfSecFormat.sectionBreak)
-    {
-        // Continuous break
-        case RTF_SECTIONBREAK_CONTINUOUS:
-            strcat( sbr, "\\sbknone" );
-            break;
+    return number;
+}
 
-        // Column break
-        case RTF_SECTIONBREAK_COLUMN:
-            strcat( sbr, "\\sbkcol" );
-            break;
 
-        // Page break
-        case RTF_SECTIONBREAK_PAGE:
-            strcat( sbr, "\\sbkpage" );
-            break;
+// Appends color table entry
+int RtfWriter::append_color(unsigned long rgb)
+{
+    RtfTables& tables = edit_tables();
+    int number = (int)tables.colors.size();
+    tables.colors.push_back( rgb );
+    tables.colorIndex.emplace( rgb, number );
 
-        // Even-page break
-        case RTF_SECTIONBREAK_EVENPAGE:
-            strcat( sbr, "\\sbkeven" );
-            break;
+    // Format color table entry
+    RtfStringSink sink( tables.colorTable );
+    write_colorentry( sink, rgb );
 
-        // Odd-page break
-        case RTF_SECTIONBREAK_ODDPAGE:
-            strcat( sbr, "\\sbkodd" );
-            break;
-    }
+    return number;
+}
 
-    // Format section columns
-    char cols[100] = "";
-    if ( _rtfSecFormat.cols == true )
-    {
-        // Format columns
-        sprintf( cols, "\\cols%d\\colsx%d", _rtfSecFormat.colsNumber, _rtfSecFormat.colsDistance );
 
-        if ( _rtfSecFormat.colsLineBetween )
-            strcat( cols, "\\linebetcol" );
-    }
+// Writes RTF font table entry
+void RtfWriter::write_fontentry(RtfSink& sink, int number, const RtfFont& font)
+{
+    sink.emit( "{\\f", number );
+    sink.write( rtf_lookup(rtfFontFamilyNames, font.family) );
+    sink.emit( "\\fcharset", font.charset );
+    if ( font.charset == 0 )
+        sink.write( "\\cpg1252" );
+    sink.put( ' ' );
+    sink.write( font.name );
+    sink.put( '}' );
+}
 
-    sprintf( rtfText, "\n%s%s%s\\pgwsxn%d\\pghsxn%d\\marglsxn%d\\margrsxn%d\\margtsxn%d\\margbsxn%d\\guttersxn%d\\headery%d\\footery%d",
-        text, sbr, cols, _rtfSecFormat.pageWidth, _rtfSecFormat.pageHeight, _rtfSecFormat.pageMarginLeft, _rtfSecFormat.pageMarginRight,
-        _rtfSecFormat.pageMarginTop, _rtfSecFormat.pageMarginBottom, _rtfSecFormat.pageGutterWidth, _rtfSecFormat.pageHeaderOffset, _rtfSecFormat.pageFooterOffset );
 
-    // Writes RTF section formatting properties
-    if ( fwrite( rtfText, 1, strlen(rtfText), _rtfFile ) < strlen(rtfText) )
-        result = false;
+// Writes RTF color table entry
+void RtfWriter::write_colorentry(RtfSink& sink, unsigned long rgb)
+{
+    sink.emit( "\\red", (int)( ( rgb >> 16 ) & 0xff ) );
+    sink.emit( "\\green", (int)( ( rgb >> 8 ) & 0xff ) );
+    sink.emit( "\\blue", (int)( rgb & 0xff ) );
+    sink.put( ';' );
+}
+
+
+// Sets RTF document formatting properties
+void RtfWriter::set_documentformat(RTF_DOCUMENT_FORMAT* df)
+{
+    // Set new RTF document formatting properties
+    memcpy( &_rtfDocFormat, df, sizeof(RTF_DOCUMENT_FORMAT) );
+}
+
+
+// Adds paragraph style, returns its style number. Returns 0 while a document with written style sheet is open
+int RtfWriter::add_style(const char* name, const RTF_PARAGRAPH_FORMAT* pf)
+{
+    // Style sheet of an open document is already written
+    if ( _rtfOpen && !_rtfDeferredHeader )
+        return 0;
+
+    RtfStyle style;
+    style.name = name != NULL ? name : "";
+    memcpy( &style.format, pf, sizeof(RTF_PARAGRAPH_FORMAT) );
+    RtfTables& tables = edit_tables();
+    tables.styles.push_back( style );
+    int number = (int)tables.styles.size();
+
+    // Style sheet is rebuilt with every new style
+    tables.styleSheet.clear();
+    RtfStringSink sink( tables.styleSheet );
+    sink.write( "{\\stylesheet{\\s0 Normal;}" );
+    for ( size_t i=0; i<tables.styles.size(); i++ )
+    {
+        sink.emit( "{\\s", (int)i + 1 );
+        write_paragraphproperties( sink, tables.styles[i].format );
+        sink.emit( "\\sbasedon", 0 );
+        sink.emit( "\\snext", (int)i + 1 );
+        sink.put( ' ' );
+        sink.write( tables.styles[i].name );
+        sink.write( ";}" );
+    }
+    sink.put( '}' );
+
+    return number;
+}
+
+
+// Sets style of following paragraphs, 0 for none
+void RtfWriter::set_paragraphstyle(int style)
+{
+    if ( style < 0 || style > (int)_rtfTables->styles.size() )
+        return;
+
+    _rtfParagraphStyle = style;
+    if ( style == 0 )
+        return;
+
+    // Paragraph format starts from the style, paragraph kind is kept
+    RTF_PARAGRAPH_FORMAT pf;
+    memcpy( &pf, &_rtfTables->styles[style - 1].format, sizeof(RTF_PARAGRAPH_FORMAT) );
+    pf.newParagraph = _rtfParFormat.newParagraph;
+    pf.defaultParagraph = _rtfParFormat.defaultParagraph;
+    pf.tableText = _rtfParFormat.tableText;
+    pf.tabbedText = _rtfParFormat.tabbedText;
+    pf.paragraphText = _rtfParFormat.paragraphText;
+    pf.paragraphBreak = _rtfParFormat.paragraphBreak;
+    memcpy( &_rtfParFormat, &pf, sizeof(RTF_PARAGRAPH_FORMAT) );
+}
+
+
+// Gets style of following paragraphs
+int RtfWriter::get_paragraphstyle()
+{
+    return _rtfParagraphStyle;
+}
+
+
+// Writes RTF document formatting properties
+bool RtfWriter::write_documentformat()
+{
+    return write_documentformat( *_rtfSink );
+}
+
+
+// Writes RTF document formatting properties to sink
+bool RtfWriter::write_documentformat(RtfSink& sink)
+{
+    sink.emit( "\\viewkind", _rtfDocFormat.viewKind );
+    sink.emit( "\\viewscale", _rtfDocFormat.viewScale );
+    sink.emit( "\\paperw", _rtfDocFormat.paperWidth );
+    sink.emit( "\\paperh", _rtfDocFormat.paperHeight );
+    sink.emit( "\\margl", _rtfDocFormat.marginLeft );
+    sink.emit( "\\margr", _rtfDocFormat.marginRight );
+    sink.emit( "\\margt", _rtfDocFormat.marginTop );
+    sink.emit( "\\margb", _rtfDocFormat.marginBottom );
+    sink.emit( "\\gutter", _rtfDocFormat.gutterWidth );
+
+    if ( _rtfDocFormat.facingPages )
+        sink.write( "\\facingp" );
+    if ( _rtfDocFormat.readOnly )
+        sink.write( "\\annotprot" );
 
     // Return error flag
-    return result;
+    return sink.good();
+}
+
+
+// Sets RTF section formatting properties
+void RtfWriter::set_sectionformat(RTF_SECTION_FORMAT* sf)
+{
+    // Set new RTF section formatting properties
+    memcpy( &_rtfSecFormat, sf, sizeof(RTF_SECTION_FORMAT) );
+}
+
+
+// Writes RTF section formatting properties
+bool RtfWriter::write_sectionformat()
+{
+    return write_sectionformat( *_rtfSink );
+}
+
+
+// Writes RTF section formatting properties to sink
+bool RtfWriter::write_sectionformat(RtfSink& sink)
+{
+    // Format new section
+    sink.put( '\n' );
+    if ( _rtfSecFormat.newSection )
+        sink.write( "\\sect" );
+    if ( _rtfSecFormat.defaultSection )
+        sink.write( "\\sectd" );
+    if ( _rtfSecFormat.showPageNumber )
+    {
+        sink.emit( "\\pgnx", _rtfSecFormat.pageNumberOffsetX );
+        sink.emit( "\\pgny", _rtfSecFormat.pageNumberOffsetY );
+    }
+
+    // Format section break
+    sink.write( rtf_lookup(rtfSectionBreakNames, _rtfSecFormat.sectionBreak) );
+
+    // Format section columns
+    if ( _rtfSecFormat.cols == true )
+    {
+        // Format columns
+        sink.emit( "\\cols", _rtfSecFormat.colsNumber );
+        sink.emit( "\\colsx", _rtfSecFormat.colsDistance );
+
+        if ( _rtfSecFormat.colsLineBetween )
+            sink.write( "\\linebetcol" );
+    }
+
+    // Format page size and margins
+    sink.emit( "\\pgwsxn", _rtfSecFormat.pageWidth );
+    sink.emit( "\\pghsxn", _rtfSecFormat.pageHeight );
+    sink.emit( "\\marglsxn", _rtfSecFormat.pageMarginLeft );
+    sink.emit( "\\margrsxn", _rtfSecFormat.pageMarginRight );
+    sink.emit( "\\margtsxn", _rtfSecFormat.pageMarginTop );
+    sink.emit( "\\margbsxn", _rtfSecFormat.pageMarginBottom );
+    sink.emit( "\\guttersxn", _rtfSecFormat.pageGutterWidth );
+    sink.emit( "\\headery", _rtfSecFormat.pageHeaderOffset );
+    sink.emit( "\\footery", _rtfSecFormat.pageFooterOffset );
+
+    // Return error flag
+    return sink.good();
 }
 
 
@@ -459,396 +1260,731 @@ void RtfWriter::set_paragraphformat(RTF_PARAGRAPH_FORMAT* pf)
 // Writes RTF paragraph formatting properties
 bool RtfWriter::write_paragraphformat()
 {
-    // Set error flag
-    bool result = true;
+    // Write paragraph with its own text
+    const char* text = _rtfParFormat.paragraphText;
+    return write_paragraph( text != NULL ? std::string_view(text) : std::string_view() );
+}
+
+
+// Writes RTF paragraph formatting properties followed by paragraph text
+bool RtfWriter::write_paragraph(std::string_view paragraphText)
+{
+    // Writes RTF paragraph formatting properties
+    write_paragraphstart();
+
+    // Writes paragraph text straight from the caller's buffer
+    write_narrowtext( *_rtfSink, paragraphText );
+
+    // Return error flag
+    return write_paragraphend();
+}
+
+
+// Writes RTF paragraph formatting properties preceding paragraph text
+void RtfWriter::write_paragraphstart()
+{
+    RtfSink& sink = *_rtfSink;
+
+    // Set paragraph tabbed text
+    if ( _rtfParFormat.tabbedText == true )
+        sink.write( "\\tab " );
+    else if ( _rtfStateValid && _rtfLastStyle == _rtfParagraphStyle && rtf_same_layout( _rtfLastFormat, _rtfParFormat ) )
+        write_paragraphdelta( sink, _rtfLastFormat, _rtfParFormat );
+    else
+        write_paragraphprefix( sink, _rtfParFormat );
+
+    // Text runs are formatted against the paragraph character format
+    if ( _rtfParFormat.tabbedText == false )
+        memcpy( &_rtfRunFormat, &_rtfParFormat.CHARACTER, sizeof(RTF_CHARACTER_FORMAT) );
+
+    remember_paragraph( _rtfParFormat );
+}
+
 
-    // RTF document text
-    char rtfText[4096];
-    strcpy( rtfText, "" );
+// Remembers emitted paragraph state for the delta path
+void RtfWriter::remember_paragraph(const RTF_PARAGRAPH_FORMAT& pf)
+{
+    if ( pf.tabbedText == true )
+        return;
+
+    // Styled paragraphs always take the delta path, so repeated styles write only \sN and overrides
+    if ( _rtfMinimalOutput || _rtfParagraphStyle > 0 )
+    {
+        memcpy( &_rtfLastFormat, &pf, sizeof(RTF_PARAGRAPH_FORMAT) );
+        _rtfLastStyle = _rtfParagraphStyle;
 
+        // Paragraphs without \pard inherit unknown properties
+        _rtfStateValid = pf.defaultParagraph;
+    }
+    else
+        _rtfStateValid = false;
+}
+
+
+// Completes RTF paragraph after its text
+bool RtfWriter::write_paragraphend()
+{
+    // Paragraph is complete, let the sink apply its flush policy
+    _rtfSink->end_block();
+
+    // Return error flag
+    return _rtfSink->good();
+}
+
+
+// Writes full RTF paragraph formatting properties
+void RtfWriter::write_paragraphprefix(RtfSink& sink, const RTF_PARAGRAPH_FORMAT& pf)
+{
     // Format new paragraph
-    char text[1024] = "";
-    if ( _rtfParFormat.newParagraph )
-        strcat( text, "\\par" );
-    if ( _rtfParFormat.defaultParagraph )
-        strcat( text, "\\pard" );
-    if ( _rtfParFormat.tableText == false )
-        strcat( text, "\\plain" );
+    sink.put( '\n' );
+    if ( pf.newParagraph )
+        sink.write( "\\par" );
+    if ( pf.defaultParagraph )
+        sink.write( "\\pard" );
+    if ( pf.tableText == false )
+        sink.write( "\\plain" );
+    else
+        sink.write( "\\intbl" );
+
+    sink.write( rtf_lookup(rtfParagraphBreakNames, pf.paragraphBreak) );
+
+    // Style link, readers expect the style properties with the paragraph
+    if ( _rtfParagraphStyle > 0 )
+        sink.emit( "\\s", _rtfParagraphStyle );
+
+    write_paragraphproperties( sink, pf );
+    sink.put( ' ' );
+}
+
+
+// Writes RTF paragraph properties following paragraph type and style
+void RtfWriter::write_paragraphproperties(RtfSink& sink, const RTF_PARAGRAPH_FORMAT& pf)
+{
+    // Format aligment
+    sink.write( rtf_lookup(rtfParagraphAlignNames, pf.paragraphAligment) );
+
+    // Format tabs
+    if ( pf.paragraphTabs == true )
+    {
+        // Set tab kind
+        sink.write( rtf_lookup(rtfTabKindNames, pf.TABS.tabKind) );
+
+        // Set tab leader
+        sink.write( rtf_lookup(rtfTabLeadNames, pf.TABS.tabLead) );
+
+        // Set tab position
+        sink.emit( "\\tx", pf.TABS.tabPosition );
+    }
+
+    // Format bullets and numbering
+    if ( pf.paragraphNums == true )
+    {
+        sink.write( "{\\*\\pn" );
+        sink.emit( "\\pnlvl", pf.NUMS.numsLevel );
+        sink.emit( "\\pnsp", pf.NUMS.numsSpace );
+        sink.write( "\\pntxtb " );
+        sink.put( pf.NUMS.numsChar );
+        sink.put( '}' );
+    }
+
+    // Format paragraph borders
+    if ( pf.paragraphBorders == true )
+    {
+        // Format paragraph border kind
+        sink.write( rtf_lookup(rtfBorderKindNames, pf.BORDERS.borderKind) );
+
+        // Format paragraph border type
+        sink.write( get_bordername(pf.BORDERS.borderType) );
+
+        // Set paragraph border width
+        sink.emit( "\\brdrw", pf.BORDERS.borderWidth );
+        sink.emit( "\\brsp", pf.BORDERS.borderSpace );
+
+        // Set paragraph border color
+        sink.emit( "\\brdrcf", pf.BORDERS.borderColor );
+    }
+
+    // Format paragraph shading
+    if ( pf.paragraphShading == true )
+    {
+        // Format paragraph shading
+        sink.write( get_shadingname( pf.SHADING.shadingType, false ) );
+
+        // Set paragraph shading color
+        sink.emit( "\\cfpat", pf.SHADING.shadingFillColor );
+        sink.emit( "\\cbpat", pf.SHADING.shadingBkColor );
+    }
+
+    // Format indents and spacing
+    sink.emit( "\\fi", pf.firstLineIndent );
+    sink.emit( "\\li", pf.leftIndent );
+    sink.emit( "\\ri", pf.rightIndent );
+    sink.emit( "\\sb", pf.spaceBefore );
+    sink.emit( "\\sa", pf.spaceAfter );
+    sink.emit( "\\sl", pf.lineSpacing );
+
+    // Format paragraph font
+    write_characterformat( sink, pf.CHARACTER );
+}
+
+
+// Writes full RTF character formatting properties
+void RtfWriter::write_characterformat(RtfSink& sink, const RTF_CHARACTER_FORMAT& cf)
+{
+    sink.emit( "\\animtext", cf.animatedCharacter );
+    sink.emit( "\\expndtw", cf.expandCharacter );
+    sink.emit( "\\kerning", cf.kerningCharacter );
+    sink.emit( "\\charscalex", cf.scaleCharacter );
+    sink.emit( "\\f", cf.fontNumber );
+    sink.emit( "\\fs", cf.fontSize );
+    sink.emit( "\\cf", cf.foregroundColor );
+
+    sink.write( cf.boldCharacter ? "\\b" : "\\b0" );
+    sink.write( cf.capitalCharacter ? "\\caps" : "\\caps0" );
+    sink.write( cf.doublestrikeCharacter ? "\\striked1" : "\\striked0" );
+    if ( cf.embossCharacter )
+        sink.write( "\\embo" );
+    if ( cf.engraveCharacter )
+        sink.write( "\\impr" );
+    sink.write( cf.italicCharacter ? "\\i" : "\\i0" );
+    sink.write( cf.outlineCharacter ? "\\outl" : "\\outl0" );
+    sink.write( cf.shadowCharacter ? "\\shad" : "\\shad0" );
+    sink.write( cf.smallcapitalCharacter ? "\\scaps" : "\\scaps0" );
+    sink.write( cf.strikeCharacter ? "\\strike" : "\\strike0" );
+    if ( cf.subscriptCharacter )
+        sink.write( "\\sub" );
+    if ( cf.superscriptCharacter )
+        sink.write( "\\super" );
+
+    sink.write( rtf_lookup(rtfUnderlineNames, cf.underlineCharacter) );
+}
+
+
+// Writes RTF paragraph formatting properties changed since the last paragraph
+void RtfWriter::write_paragraphdelta(RtfSink& sink, const RTF_PARAGRAPH_FORMAT& last, const RTF_PARAGRAPH_FORMAT& pf)
+{
+    // Paragraph layout is unchanged, so \pard and \plain are not needed
+    bool control = false;
+    sink.put( '\n' );
+    if ( pf.newParagraph )
+    {
+        sink.write( "\\par" );
+        control = true;
+    }
+    if ( pf.paragraphBreak != RTF_PARAGRAPHBREAK_NONE )
+    {
+        sink.write( rtf_lookup(rtfParagraphBreakNames, pf.paragraphBreak) );
+        control = true;
+    }
+    if ( _rtfParagraphStyle > 0 )
+    {
+        sink.emit( "\\s", _rtfParagraphStyle );
+        control = true;
+    }
+
+    if ( write_propertydelta( sink, last, pf ) )
+        control = true;
+
+    // Control word delimiter, a bare space would become paragraph text
+    if ( control )
+        sink.put( ' ' );
+}
+
+
+// Writes RTF aligment, indent, spacing and character properties changed between two states
+bool RtfWriter::write_propertydelta(RtfSink& sink, const RTF_PARAGRAPH_FORMAT& last, const RTF_PARAGRAPH_FORMAT& pf)
+{
+    bool control = false;
+
+    // Format aligment
+    if ( pf.paragraphAligment != last.paragraphAligment )
+    {
+        sink.write( rtf_lookup(rtfParagraphAlignNames, pf.paragraphAligment) );
+        control = true;
+    }
+
+    // Format indents and spacing
+    if ( pf.firstLineIndent != last.firstLineIndent )
+    {
+        sink.emit( "\\fi", pf.firstLineIndent );
+        control = true;
+    }
+    if ( pf.leftIndent != last.leftIndent )
+    {
+        sink.emit( "\\li", pf.leftIndent );
+        control = true;
+    }
+    if ( pf.rightIndent != last.rightIndent )
+    {
+        sink.emit( "\\ri", pf.rightIndent );
+        control = true;
+    }
+    if ( pf.spaceBefore != last.spaceBefore )
+    {
+        sink.emit( "\\sb", pf.spaceBefore );
+        control = true;
+    }
+    if ( pf.spaceAfter != last.spaceAfter )
+    {
+        sink.emit( "\\sa", pf.spaceAfter );
+        control = true;
+    }
+    if ( pf.lineSpacing != last.lineSpacing )
+    {
+        sink.emit( "\\sl", pf.lineSpacing );
+        control = true;
+    }
+
+    // Format changed character properties
+    if ( write_characterdelta( sink, last.CHARACTER, pf.CHARACTER ) )
+        control = true;
+
+    return control;
+}
+
+
+// Writes RTF character formatting properties changed between two states
+bool RtfWriter::write_characterdelta(RtfSink& sink, const RTF_CHARACTER_FORMAT& from, const RTF_CHARACTER_FORMAT& to)
+{
+    bool control = false;
+
+    if ( to.animatedCharacter != from.animatedCharacter )
+    {
+        sink.emit( "\\animtext", to.animatedCharacter );
+        control = true;
+    }
+    if ( to.expandCharacter != from.expandCharacter )
+    {
+        sink.emit( "\\expndtw", to.expandCharacter );
+        control = true;
+    }
+    if ( to.kerningCharacter != from.kerningCharacter )
+    {
+        sink.emit( "\\kerning", to.kerningCharacter );
+        control = true;
+    }
+    if ( to.scaleCharacter != from.scaleCharacter )
+    {
+        sink.emit( "\\charscalex", to.scaleCharacter );
+        control = true;
+    }
+    if ( to.fontNumber != from.fontNumber )
+    {
+        sink.emit( "\\f", to.fontNumber );
+        control = true;
+    }
+    if ( to.fontSize != from.fontSize )
+    {
+        sink.emit( "\\fs", to.fontSize );
+        control = true;
+    }
+    if ( to.foregroundColor != from.foregroundColor )
+    {
+        sink.emit( "\\cf", to.foregroundColor );
+        control = true;
+    }
+    if ( to.boldCharacter != from.boldCharacter )
+    {
+        sink.write( to.boldCharacter ? "\\b" : "\\b0" );
+        control = true;
+    }
+    if ( to.capitalCharacter != from.capitalCharacter )
+    {
+        sink.write( to.capitalCharacter ? "\\caps" : "\\caps0" );
+        control = true;
+    }
+    if ( to.doublestrikeCharacter != from.doublestrikeCharacter )
+    {
+        sink.write( to.doublestrikeCharacter ? "\\striked1" : "\\striked0" );
+        control = true;
+    }
+    if ( to.embossCharacter != from.embossCharacter )
+    {
+        sink.write( to.embossCharacter ? "\\embo" : "\\embo0" );
+        control = true;
+    }
+    if ( to.engraveCharacter != from.engraveCharacter )
+    {
+        sink.write( to.engraveCharacter ? "\\impr" : "\\impr0" );
+        control = true;
+    }
+    if ( to.italicCharacter != from.italicCharacter )
+    {
+        sink.write( to.italicCharacter ? "\\i" : "\\i0" );
+        control = true;
+    }
+    if ( to.outlineCharacter != from.outlineCharacter )
+    {
+        sink.write( to.outlineCharacter ? "\\outl" : "\\outl0" );
+        control = true;
+    }
+    if ( to.shadowCharacter != from.shadowCharacter )
+    {
+        sink.write( to.shadowCharacter ? "\\shad" : "\\shad0" );
+        control = true;
+    }
+    if ( to.smallcapitalCharacter != from.smallcapitalCharacter )
+    {
+        sink.write( to.smallcapitalCharacter ? "\\scaps" : "\\scaps0" );
+        control = true;
+    }
+    if ( to.strikeCharacter != from.strikeCharacter )
+    {
+        sink.write( to.strikeCharacter ? "\\strike" : "\\strike0" );
+        control = true;
+    }
+
+    // Subscript and superscript share a single off switch
+    if ( to.subscriptCharacter != from.subscriptCharacter || to.superscriptCharacter != from.superscriptCharacter )
+    {
+        sink.write( "\\nosupersub" );
+        if ( to.subscriptCharacter )
+            sink.write( "\\sub" );
+        if ( to.superscriptCharacter )
+            sink.write( "\\super" );
+        control = true;
+    }
+
+    if ( to.underlineCharacter != from.underlineCharacter )
+    {
+        sink.write( rtf_lookup(rtfUnderlineNames, to.underlineCharacter) );
+        control = true;
+    }
+
+    return control;
+}
+
+
+// Enables or disables minimal output mode
+void RtfWriter::set_minimaloutput(bool minimal)
+{
+    _rtfMinimalOutput = minimal;
+    _rtfStateValid = false;
+}
+
+
+// Buffers the document body and writes only used fonts and colors to the header, set before open()
+void RtfWriter::set_deferredheader(bool deferred)
+{
+    _rtfDeferredHeader = deferred;
+}
+
+
+// Gets deferred header mode
+bool RtfWriter::get_deferredheader()
+{
+    return _rtfDeferredHeader;
+}
+
+
+// Sets backend of documents opened by file name, Windows has no memory-mapped backend
+void RtfWriter::set_filebackend(int backend)
+{
+    _rtfFileBackend = backend;
+}
+
+
+// Gets backend of documents opened by file name
+int RtfWriter::get_filebackend()
+{
+    return _rtfFileBackend;
+}
+
+
+// Gets minimal output mode
+bool RtfWriter::get_minimaloutput()
+{
+    return _rtfMinimalOutput;
+}
+
+
+// Starts new RTF paragraph
+int RtfWriter::start_paragraph(const char* text, bool newPar)
+{
+    return start_paragraph( text != NULL ? std::string_view(text) : std::string_view(), newPar );
+}
+
+
+// Starts new RTF paragraph
+int RtfWriter::start_paragraph(const char* text, size_t length, bool newPar)
+{
+    return start_paragraph( std::string_view(text, length), newPar );
+}
+
+
+// Starts new RTF paragraph
+int RtfWriter::start_paragraph(std::string_view text, bool newPar)
+{
+    // Set error flag
+    int error = RTF_SUCCESS;
+
+    // Set new paragraph
+    _rtfParFormat.newParagraph = newPar;
+
+    // Starts new RTF paragraph, text is streamed without a copy
+    if( !RtfWriter::write_paragraph(text) )
+        error = RTF_PARAGRAPHFORMAT_ERROR;
+
+    // Return error flag
+    return error;
+}
+
+
+// Starts new RTF paragraph with UTF-16 text
+int RtfWriter::start_paragraph(std::u16string_view text, bool newPar)
+{
+    // Set error flag
+    int error = RTF_SUCCESS;
+
+    // Set new paragraph
+    _rtfParFormat.newParagraph = newPar;
+
+    // Starts new RTF paragraph, text is escaped and encoded on the fly
+    write_paragraphstart();
+    _rtfSink->write_text( text );
+    if( !write_paragraphend() )
+        error = RTF_PARAGRAPHFORMAT_ERROR;
+
+    // Return error flag
+    return error;
+}
+
+
+// Starts new RTF paragraph with wide text
+int RtfWriter::start_paragraph(std::wstring_view text, bool newPar)
+{
+    // Set error flag
+    int error = RTF_SUCCESS;
+
+    // Set new paragraph
+    _rtfParFormat.newParagraph = newPar;
+
+    // Starts new RTF paragraph, text is escaped and encoded on the fly
+    write_paragraphstart();
+    _rtfSink->write_text( text );
+    if( !write_paragraphend() )
+        error = RTF_PARAGRAPHFORMAT_ERROR;
+
+    // Return error flag
+    return error;
+}
+
+
+// Starts new RTF paragraph with registered format
+int RtfWriter::start_paragraph(int format, std::string_view text, bool newPar)
+{
+    if ( format < 1 || format > (int)_rtfFormats.size() )
+        return RTF_PARAGRAPHFORMAT_ERROR;
+
+    RtfFormatEntry& entry = _rtfFormats[format - 1];
+    RtfSink& sink = *_rtfSink;
+
+    // Render prefix only after changes through edit_paragraphformat or a style switch
+    if ( entry.dirty || entry.style != _rtfParagraphStyle )
+    {
+        RTF_PARAGRAPH_FORMAT pf;
+        memcpy( &pf, &entry.format, sizeof(RTF_PARAGRAPH_FORMAT) );
+        pf.newParagraph = false;
+
+        entry.prefix.clear();
+        RtfStringSink prefixSink( entry.prefix );
+        if ( pf.tabbedText == true )
+            prefixSink.write( "\\tab " );
+        else
+            write_paragraphprefix( prefixSink, pf );
+        entry.style = _rtfParagraphStyle;
+        entry.dirty = false;
+    }
+
+    // Cached prefix starts with a line break, \par goes right after it
+    if ( newPar && entry.format.tabbedText == false )
+    {
+        sink.write( "\n\\par" );
+        sink.write( std::string_view(entry.prefix).substr(1) );
+    }
+    else
+        sink.write( entry.prefix );
+
+    // Text runs are formatted against the paragraph character format
+    if ( entry.format.tabbedText == false )
+        memcpy( &_rtfRunFormat, &entry.format.CHARACTER, sizeof(RTF_CHARACTER_FORMAT) );
+
+    remember_paragraph( entry.format );
+
+    write_narrowtext( sink, text );
+
+    // Return error flag
+    return write_paragraphend() ? RTF_SUCCESS : RTF_PARAGRAPHFORMAT_ERROR;
+}
+
+
+// Appends text run with own character format to current paragraph
+int RtfWriter::append_run(std::string_view text, const RTF_CHARACTER_FORMAT* cf)
+{
+    // Set error flag
+    int error = RTF_SUCCESS;
+
+    bool group = write_runstart( cf );
+    write_narrowtext( *_rtfSink, text );
+    if ( group )
+        _rtfSink->put( '}' );
+
+    if ( !_rtfSink->good() )
+        error = RTF_PARAGRAPHFORMAT_ERROR;
+
+    // Return error flag
+    return error;
+}
+
+
+// Appends RTF code as is to current paragraph, for callers embedding control words
+int RtfWriter::append_rtf(std::string_view rtf)
+{
+    return _rtfSink->write( rtf ) ? RTF_SUCCESS : RTF_PARAGRAPHFORMAT_ERROR;
+}
+
+
+// Writes narrow text in the current text encoding
+void RtfWriter::write_narrowtext(RtfSink& sink, std::string_view text)
+{
+    if ( _rtfTextEncoding == RTF_TEXTENCODING_UTF8 )
+        sink.write_text( text );
+    else if ( _rtfTextEncoding == RTF_TEXTENCODING_RAW )
+        sink.write( text );
     else
-        strcat( text, "\\intbl" );
+        sink.write_ansi( text );
+}
+
 
-    switch (_rtfParFormat.paragraphBreak)
-    {
-        // No break
-        case RTF_PARAGRAPHBREAK_NONE:
-            break;
+// Appends wide text run with own character format to current paragraph
+int RtfWriter::append_run(std::wstring_view text, const RTF_CHARACTER_FORMAT* cf)
+{
+    // Set error flag
+    int error = RTF_SUCCESS;
 
-        // Page break;
-        case RTF_PARAGRAPHBREAK_PAGE:
-            strcat( text, "\\page" );
-            break;
+    bool group = write_runstart( cf );
+    _rtfSink->write_text( text );
+    if ( group )
+        _rtfSink->put( '}' );
 
-        // Column break;
-        case RTF_PARAGRAPHBREAK_COLUMN:
-            strcat( text, "\\column" );
-            break;
+    if ( !_rtfSink->good() )
+        error = RTF_PARAGRAPHFORMAT_ERROR;
 
-        // Line break;
-        case RTF_PARAGRAPHBREAK_LINE:
-            strcat( text, "\\line" );
-            break;
-    }
+    // Return error flag
+    return error;
+}
 
-    // Format aligment
-    switch (_rtfParFormat.paragraphAligment)
-    {
-        // Left aligned paragraph
-        case RTF_PARAGRAPHALIGN_LEFT:
-            strcat( text, "\\ql" );
-            break;
 
-        // Center aligned paragraph
-        case RTF_PARAGRAPHALIGN_CENTER:
-            strcat( text, "\\qc" );
-            break;
+// Opens text run group with the properties differing from the paragraph, returns false if no group is needed
+bool RtfWriter::write_runstart(const RTF_CHARACTER_FORMAT* cf)
+{
+    if ( cf == NULL )
+        return false;
 
-        // Right aligned paragraph
-        case RTF_PARAGRAPHALIGN_RIGHT:
-            strcat( text, "\\qr" );
-            break;
+    // Group restores the paragraph character format after the run
+    _rtfSink->put( '{' );
+    if ( write_characterdelta( *_rtfSink, _rtfRunFormat, *cf ) )
+        _rtfSink->put( ' ' );
 
-        // Justified aligned paragraph
-        case RTF_PARAGRAPHALIGN_JUSTIFY:
-            strcat( text, "\\qj" );
-            break;
-    }
+    return true;
+}
 
-    // Format tabs
-    if ( _rtfParFormat.paragraphTabs == true )
-    {
-        // Set tab kind
-        switch ( _rtfParFormat.TABS.tabKind )
-        {
-            // No tab
-            case RTF_PARAGRAPHTABKIND_NONE:
-                break;
-
-            // Centered tab
-            case RTF_PARAGRAPHTABKIND_CENTER:
-                strcat( text, "\\tqc" );
-                break;
-
-            // Flush-right tab
-            case RTF_PARAGRAPHTABKIND_RIGHT:
-                strcat( text, "\\tqr" );
-                break;
-
-            // Decimal tab
-            case RTF_PARAGRAPHTABKIND_DECIMAL:
-                strcat( text, "\\tqdec" );
-                break;
-        }
 
-        // Set tab leader
-        switch ( _rtfParFormat.TABS.tabLead )
-        {
-            // No lead
-            case RTF_PARAGRAPHTABLEAD_NONE:
-                break;
-
-            // Leader dots
-            case RTF_PARAGRAPHTABLEAD_DOT:
-                strcat( text, "\\tldot" );
-                break;
-
-            // Leader middle dots
-            case RTF_PARAGRAPHTABLEAD_MDOT:
-                strcat( text, "\\tlmdot" );
-                break;
-
-            // Leader hyphens
-            case RTF_PARAGRAPHTABLEAD_HYPH:
-                strcat( text, "\\tlhyph" );
-                break;
-
-            // Leader underline
-            case RTF_PARAGRAPHTABLEAD_UNDERLINE:
-                strcat( text, "\\tlul" );
-                break;
-
-            // Leader thick line
-            case RTF_PARAGRAPHTABLEAD_THICKLINE:
-                strcat( text, "\\tlth" );
-                break;
-
-            // Leader equal sign
-            case RTF_PARAGRAPHTABLEAD_EQUAL:
-                strcat( text, "\\tleq" );
-                break;
-        }
+// Opens format group, optionally with new character format
+int RtfWriter::push_format(const RTF_CHARACTER_FORMAT* cf)
+{
+    if ( _rtfFormatDepth >= RTF_MAX_FORMAT_DEPTH )
+        return RTF_PARAGRAPHFORMAT_ERROR;
 
-        // Set tab position
-        char tb[10];
-        sprintf( tb, "\\tx%d", _rtfParFormat.TABS.tabPosition );
-        strcat( text, tb );
-    }
+    // Save formatting in place, the group restores it in the document
+    RtfFormatFrame& frame = _rtfFormatStack[_rtfFormatDepth++];
+    memcpy( &frame.format, &_rtfParFormat, sizeof(RTF_PARAGRAPH_FORMAT) );
+    memcpy( &frame.runFormat, &_rtfRunFormat, sizeof(RTF_CHARACTER_FORMAT) );
+    frame.style = _rtfParagraphStyle;
 
-    // Format bullets and numbering
-    if ( _rtfParFormat.paragraphNums == true )
+    _rtfSink->put( '{' );
+    if ( cf != NULL )
     {
-        char nums[1024];
-        sprintf( nums, "{\\*\\pn\\pnlvl%d\\pnsp%d\\pntxtb %c}", _rtfParFormat.NUMS.numsLevel, _rtfParFormat.NUMS.numsSpace, _rtfParFormat.NUMS.numsChar );
-        strcat( text, nums );
+        if ( write_characterdelta( *_rtfSink, _rtfRunFormat, *cf ) )
+            _rtfSink->put( ' ' );
+        memcpy( &_rtfRunFormat, cf, sizeof(RTF_CHARACTER_FORMAT) );
+        memcpy( &_rtfParFormat.CHARACTER, cf, sizeof(RTF_CHARACTER_FORMAT) );
     }
 
-    // Format paragraph borders
-    if ( _rtfParFormat.paragraphBorders == true )
-    {
-        char border[1024] = "";
+    // Return error flag
+    return _rtfSink->good() ? RTF_SUCCESS : RTF_PARAGRAPHFORMAT_ERROR;
+}
 
-        // Format paragraph border kind
-        switch (_rtfParFormat.BORDERS.borderKind)
-        {
-            // No border
-            case RTF_PARAGRAPHBORDERKIND_NONE:
-                break;
-
-            // Border top
-            case RTF_PARAGRAPHBORDERKIND_TOP:
-                strcat( border, "\\brdrt" );
-                break;
-
-            // Border bottom
-            case RTF_PARAGRAPHBORDERKIND_BOTTOM:
-                strcat( border, "\\brdrb" );
-                break;
-
-            // Border left
-            case RTF_PARAGRAPHBORDERKIND_LEFT:
-                strcat( border, "\\brdrl" );
-                break;
-
-            // Border right
-            case RTF_PARAGRAPHBORDERKIND_RIGHT:
-                strcat( border, "\\brdrr" );
-                break;
-
-            // Border box
-            case RTF_PARAGRAPHBORDERKIND_BOX:
-                strcat( border, "\\box" );
-                break;
-        }
 
-        // Format paragraph border type
-        char *br = RtfWriter::get_bordername(_rtfParFormat.BORDERS.borderType);
-        strcat( border, br );
+// Closes format group and restores formatting
+int RtfWriter::pop_format()
+{
+    if ( _rtfFormatDepth == 0 )
+        return RTF_PARAGRAPHFORMAT_ERROR;
 
-        // Set paragraph border width
-        char brd[100];
-        sprintf( brd, "\\brdrw%d\\brsp%d", _rtfParFormat.BORDERS.borderWidth, _rtfParFormat.BORDERS.borderSpace );
-        strcat( border, brd );
-        strcat( text, border );
+    const RtfFormatFrame& frame = _rtfFormatStack[--_rtfFormatDepth];
+    memcpy( &_rtfParFormat, &frame.format, sizeof(RTF_PARAGRAPH_FORMAT) );
+    memcpy( &_rtfRunFormat, &frame.runFormat, sizeof(RTF_CHARACTER_FORMAT) );
+    _rtfParagraphStyle = frame.style;
 
-        // Set paragraph border color
-        char brdcol[100];
-        sprintf( brdcol, "\\brdrcf%d", _rtfParFormat.BORDERS.borderColor );
-        strcat( text, brdcol );
-    }
+    // Readers differ in restoring paragraph properties, minimal output starts over
+    _rtfStateValid = false;
 
-    // Format paragraph shading
-    if ( _rtfParFormat.paragraphShading == true )
-    {
-        char shading[100];
-        sprintf( shading, "\\shading%d", _rtfParFormat.SHADING.shadingIntensity );
+    _rtfSink->put( '}' );
 
-        // Format paragraph shading
-        char* sh = RtfWriter::get_shadingname( _rtfParFormat.SHADING.shadingType, false );
-        strcat( text, sh );
+    // Return error flag
+    return _rtfSink->good() ? RTF_SUCCESS : RTF_PARAGRAPHFORMAT_ERROR;
+}
 
-        // Set paragraph shading color
-        char shcol[100];
-        sprintf( shcol, "\\cfpat%d\\cbpat%d", _rtfParFormat.SHADING.shadingFillColor, _rtfParFormat.SHADING.shadingBkColor );
-        strcat( text, shcol );
-    }
 
-    // Format paragraph font
-    char font[1024] = "";
-    sprintf( font, "\\animtext%d\\expndtw%d\\kerning%d\\charscalex%d\\f%d\\fs%d\\cf%d", _rtfParFormat.CHARACTER.animatedCharacter,
-        _rtfParFormat.CHARACTER.expandCharacter, _rtfParFormat.CHARACTER.kerningCharacter, _rtfParFormat.CHARACTER.scaleCharacter,
-        _rtfParFormat.CHARACTER.fontNumber, _rtfParFormat.CHARACTER.fontSize, _rtfParFormat.CHARACTER.foregroundColor );
-    if ( _rtfParFormat.CHARACTER.boldCharacter )
-        strcat( font, "\\b" );
-    else
-        strcat( font, "\\b0" );
-    if ( _rtfParFormat.CHARACTER.capitalCharacter )
-        strcat( font, "\\caps" );
-    else
-        strcat( font, "\\caps0" );
-    if ( _rtfParFormat.CHARACTER.doublestrikeCharacter )
-        strcat( font, "\\striked1" );
-    else
-        strcat( font, "\\striked0" );
-    if ( _rtfParFormat.CHARACTER.embossCharacter )
-        strcat( font, "\\embo" );
-    if ( _rtfParFormat.CHARACTER.engraveCharacter )
-        strcat( font, "\\impr" );
-    if ( _rtfParFormat.CHARACTER.italicCharacter )
-        strcat( font, "\\i" );
-    else
-        strcat( font, "\\i0" );
-    if ( _rtfParFormat.CHARACTER.outlineCharacter )
-        strcat( font, "\\outl" );
-    else
-        strcat( font, "\\outl0" );
-    if ( _rtfParFormat.CHARACTER.shadowCharacter )
-        strcat( font, "\\shad" );
-    else
-        strcat( font, "\\shad0" );
-    if ( _rtfParFormat.CHARACTER.smallcapitalCharacter )
-        strcat( font, "\\scaps" );
-    else
-        strcat( font, "\\scaps0" );
-    if ( _rtfParFormat.CHARACTER.strikeCharacter )
-        strcat( font, "\\strike" );
-    else
-        strcat( font, "\\strike0" );
-    if ( _rtfParFormat.CHARACTER.subscriptCharacter )
-        strcat( font, "\\sub" );
-    if ( _rtfParFormat.CHARACTER.superscriptCharacter )
-        strcat( font, "\\super" );
-
-    switch (_rtfParFormat.CHARACTER.underlineCharacter)
-    {
-        // None underline
-        case 0:
-            strcat( font, "\\ulnone" );
-            break;
-
-        // Continuous underline
-        case 1:
-            strcat( font, "\\ul" );
-            break;
-
-        // Dotted underline
-        case 2:
-            strcat( font, "\\uld" );
-            break;
-
-        // Dashed underline
-        case 3:
-            strcat( font, "\\uldash" );
-            break;
-
-        // Dash-dotted underline
-        case 4:
-            strcat( font, "\\uldashd" );
-            break;
-
-        // Dash-dot-dotted underline
-        case 5:
-            strcat( font, "\\uldashdd" );
-            break;
-
-        // Double underline
-        case 6:
-            strcat( font, "\\uldb" );
-            break;
-
-        // Heavy wave underline
-        case 7:
-            strcat( font, "\\ulhwave" );
-            break;
-
-        // Long dashed underline
-        case 8:
-            strcat( font, "\\ulldash" );
-            break;
-
-        // Thick underline
-        case 9:
-            strcat( font, "\\ulth" );
-            break;
-
-        // Thick dotted underline
-        case 10:
-            strcat( font, "\\ulthd" );
-            break;
-
-        // Thick dashed underline
-        case 11:
-            strcat( font, "\\ulthdash" );
-            break;
-
-        // Thick dash-dotted underline
-        case 12:
-            strcat( font, "\\ulthdashd" );
-            break;
-
-        // Thick dash-dot-dotted underline
-        case 13:
-            strcat( font, "\\ulthdashdd" );
-            break;
-
-        // Thick long dashed underline
-        case 14:
-            strcat( font, "\\ulthldash" );
-            break;
-
-        // Double wave underline
-        case 15:
-            strcat( font, "\\ululdbwave" );
-            break;
-
-        // Word underline
-        case 16:
-            strcat( font, "\\ulw" );
-            break;
-
-        // Wave underline
-        case 17:
-            strcat( font, "\\ulwave" );
-            break;
-    }
-
-    char txt[20] = "";
-    // Set paragraph tabbed text
-    if ( _rtfParFormat.tabbedText == false )
-    {
-        sprintf( rtfText, "\n%s\\fi%d\\li%d\\ri%d\\sb%d\\sa%d\\sl%d%s %s", text,
-            _rtfParFormat.firstLineIndent, _rtfParFormat.leftIndent, _rtfParFormat.rightIndent, _rtfParFormat.spaceBefore,
-            _rtfParFormat.spaceAfter, _rtfParFormat.lineSpacing, font, _rtfParFormat.paragraphText );
-    }
-    else
-        sprintf( rtfText, "\\tab %s", _rtfParFormat.paragraphText );
+// Registers paragraph format, returns its handle
+int RtfWriter::register_paragraphformat(const RTF_PARAGRAPH_FORMAT* pf)
+{
+    RtfFormatEntry entry;
+    memcpy( &entry.format, pf, sizeof(RTF_PARAGRAPH_FORMAT) );
+    entry.style = _rtfParagraphStyle;
+    entry.dirty = true;
+    _rtfFormats.push_back( entry );
 
-    // Writes RTF paragraph formatting properties
-    if ( fwrite( rtfText, 1, strlen(rtfText), _rtfFile ) < strlen(rtfText) )
-        result = false;
+    return (int)_rtfFormats.size();
+}
 
-    // Return error flag
-    return result;
+
+// Gets registered paragraph format for changing, its prefix is rendered again on next use.
+// Changes must be made before the next writer call, later ones call this again.
+RTF_PARAGRAPH_FORMAT* RtfWriter::edit_paragraphformat(int format)
+{
+    if ( format < 1 || format > (int)_rtfFormats.size() )
+        return NULL;
+
+    _rtfFormats[format - 1].dirty = true;
+    return &_rtfFormats[format - 1].format;
 }
 
 
-// Starts new RTF paragraph
-int RtfWriter::start_paragraph(const char* text, bool newPar)
+// Replaces registered paragraph format, its prefix is rendered again on next use
+bool RtfWriter::update_paragraphformat(int format, const RTF_PARAGRAPH_FORMAT* pf)
 {
-    // Set error flag
-    int error = RTF_SUCCESS;
+    RTF_PARAGRAPH_FORMAT* target = edit_paragraphformat( format );
+    if ( target == NULL )
+        return false;
 
-    // Copy paragraph text
-    _rtfParFormat.paragraphText = new char[strlen(text)];
-    strcpy( _rtfParFormat.paragraphText, text );
+    memcpy( target, pf, sizeof(RTF_PARAGRAPH_FORMAT) );
+    return true;
+}
 
-    // Set new paragraph
-    _rtfParFormat.newParagraph = newPar;
 
-    // Starts new RTF paragraph
-    if( !RtfWriter::write_paragraphformat() )
-        error = RTF_PARAGRAPHFORMAT_ERROR;
+// Sets encoding of narrow paragraph text
+void RtfWriter::set_textencoding(int encoding)
+{
+    _rtfTextEncoding = encoding;
+}
 
-    // Return error flag
-    return error;
+
+// Gets encoding of narrow paragraph text
+int RtfWriter::get_textencoding()
+{
+    return _rtfTextEncoding;
 }
 
 
@@ -875,64 +2011,127 @@ RTF_PARAGRAPH_FORMAT* RtfWriter::get_paragraphformat()
 }
 
 
-// Loads image from file
+// Embeds PNG or JPEG image from file
 int RtfWriter::load_image(char* image, int width, int height)
 {
-    return -1;
-}
+    // Set error flag
+    int error = RTF_SUCCESS;
 
+    // Open image file
+    FILE* file = fopen( image, "rb" );
+    if ( file == NULL )
+        return RTF_IMAGE_ERROR;
 
-// Converts binary data to hex
-char* RtfWriter::bin_hex_convert(unsigned char* binary, int size)
-{
-    char* result = new char[2*size];
+    // Cached images are copied as is
+    std::string key;
+    size_t fileSize = 0;
+    bool cacheable = _rtfImageCache != NULL && RtfImageCache::make_key( file, image, width, height, key, fileSize );
+    if ( cacheable )
+    {
+        std::shared_ptr<const std::string> group = _rtfImageCache->find( key );
+        if ( group )
+        {
+            fclose( file );
+            return _rtfSink->write( *group ) ? RTF_SUCCESS : RTF_IMAGE_ERROR;
+        }
 
-    char part1, part2;
-    for ( int i=0; i<size; i++ )
+        // Hex data plus line breaks and control words, larger images are streamed
+        cacheable = _rtfImageCache->fits( fileSize*2 + fileSize/RTF_HEXLINE_BYTES + 256 );
+    }
+
+    // Read image header, then encode the whole file
+    RTF_IMAGE_INFO info;
+    if ( !rtf_read_imageinfo( file, info ) || fseek( file, 0, SEEK_SET ) != 0 )
+        error = RTF_IMAGE_ERROR;
+    else if ( cacheable )
     {
-        part1 = binary[i] / 16;
-        if ( part1 < 10 )
-            part1 += 48;
-        else
+        std::shared_ptr<std::string> group = std::make_shared<std::string>();
+        group->reserve( fileSize*2 + fileSize/RTF_HEXLINE_BYTES + 256 );
         {
-            if ( part1 == 10 )
-                part1 = 'a';
-            if ( part1 == 11 )
-                part1 = 'b';
-            if ( part1 == 12 )
-                part1 = 'c';
-            if ( part1 == 13 )
-                part1 = 'd';
-            if ( part1 == 14 )
-                part1 = 'e';
-            if ( part1 == 15 )
-                part1 = 'f';
+            RtfStringSink sink( *group );
+            if ( !write_picture( sink, file, info, width, height ) )
+                error = RTF_IMAGE_ERROR;
         }
 
-        part2 = binary[i] % 16;
-        if ( part2 < 10 )
-            part2 += 48;
-        else
+        if ( error == RTF_SUCCESS )
         {
-            if ( part2 == 10 )
-                part2 = 'a';
-            if ( part2 == 11 )
-                part2 = 'b';
-            if ( part2 == 12 )
-                part2 = 'c';
-            if ( part2 == 13 )
-                part2 = 'd';
-            if ( part2 == 14 )
-                part2 = 'e';
-            if ( part2 == 15 )
-                part2 = 'f';
+            _rtfImageCache->insert( key, group );
+            if ( !_rtfSink->write( *group ) )
+                error = RTF_IMAGE_ERROR;
         }
+    }
+    else if ( !write_picture( *_rtfSink, file, info, width, height ) )
+        error = RTF_IMAGE_ERROR;
+
+    fclose( file );
+
+    // Return error flag
+    return error;
+}
+
+
+// Sets encoded image cache, NULL streams every image without holding it encoded
+void RtfWriter::set_imagecache(RtfImageCache* cache)
+{
+    _rtfImageCache = cache;
+}
+
+
+// Gets encoded image cache
+RtfImageCache* RtfWriter::get_imagecache()
+{
+    return _rtfImageCache;
+}
 
-        result[2*i] = part1;
-        result[2*i+1] = part2;
+
+// Writes RTF picture group with image file data
+bool RtfWriter::write_picture(RtfSink& sink, FILE* file, const RTF_IMAGE_INFO& info, int width, int height)
+{
+    // Image width and height are scale percents
+    if ( width <= 0 )
+        width = 100;
+    if ( height <= 0 )
+        height = 100;
+
+    if ( info.imageType == RTF_IMAGETYPE_PNG )
+        sink.write( "\n{\\pict\\pngblip" );
+    else
+        sink.write( "\n{\\pict\\jpegblip" );
+    sink.emit( "\\picw", info.imageWidth );
+    sink.emit( "\\pich", info.imageHeight );
+
+    // Goal size in twips at 96 dpi
+    sink.emit( "\\picwgoal", info.imageWidth * 15 );
+    sink.emit( "\\pichgoal", info.imageHeight * 15 );
+    sink.emit( "\\picscalex", width );
+    sink.emit( "\\picscaley", height );
+    sink.put( '\n' );
+
+    // Image data is hex encoded chunk by chunk
+    std::unique_ptr<unsigned char[]> chunk( new unsigned char[RTF_IMAGE_READSIZE] );
+    size_t count;
+    while ( ( count = fread( chunk.get(), 1, RTF_IMAGE_READSIZE, file ) ) > 0 )
+    {
+        if ( !sink.write_hex( chunk.get(), count ) )
+            return false;
     }
+    if ( ferror( file ) )
+        return false;
+
+    sink.put( '}' );
+
+    return sink.good();
+}
 
-    strcat( result, "\0" );
+
+// Converts binary data to hex
+char* RtfWriter::bin_hex_convert(unsigned char* binary, int size)
+{
+    // Caller frees the result with delete[]
+    char* result = new char[2*size+1];
+
+    RtfSink::encode_hex( binary, size, result );
+    result[2*size] = '\0';
 
     return result;
 }
@@ -944,31 +2143,9 @@ int RtfWriter::start_tablerow()
     // Set error flag
     int error = RTF_SUCCESS;
 
-    char tblrw[1024]="";
-    // Format table row aligment
-    switch (_rtfRowFormat.rowAligment)
-    {
-        // Left align
-        case RTF_ROWTEXTALIGN_LEFT:
-            strcat( tblrw, "\\trql" );
-            break;
-
-        // Center align
-        case RTF_ROWTEXTALIGN_CENTER:
-            strcat( tblrw, "\\trqc" );
-            break;
-
-        // Right align
-        case RTF_ROWTEXTALIGN_RIGHT:
-            strcat( tblrw, "\\trqr" );
-            break;
-    }
-
     // Writes RTF table data
-    char rtfText[1024]="";
-    sprintf( rtfText, "\n\\trowd\\trgaph115%s\\trleft%d\\trrh%d\\trpaddb%d\\trpaddfb3\\trpaddl%d\\trpaddfl3\\trpaddr%d\\trpaddfr3\\trpaddt%d\\trpaddft3",
-        tblrw, _rtfRowFormat.rowLeftMargin, _rtfRowFormat.rowHeight, _rtfRowFormat.marginTop, _rtfRowFormat.marginBottom, _rtfRowFormat.marginLeft, _rtfRowFormat.marginRight );
-    if ( fwrite( rtfText, 1, strlen(rtfText), _rtfFile ) < strlen(rtfText) )
+    write_tablerowdef( *_rtfSink, _rtfRowFormat );
+    if ( !_rtfSink->good() )
         error = RTF_TABLE_ERROR;
 
     // Return error flag
@@ -976,16 +2153,14 @@ int RtfWriter::start_tablerow()
 }
 
 
-// Ends RTF table row
-int RtfWriter::end_tablerow()
+// Starts new RTF table row with compiled cell definitions
+int RtfWriter::start_tablerow(const RtfRowTemplate& row)
 {
     // Set error flag
     int error = RTF_SUCCESS;
 
     // Writes RTF table data
-    char rtfText[1024];
-    sprintf( rtfText, "\n\\trgaph115\\row\\pard" );
-    if ( fwrite( rtfText, 1, strlen(rtfText), _rtfFile ) < strlen(rtfText) )
+    if ( !_rtfSink->write( row.rowDefinition ) )
         error = RTF_TABLE_ERROR;
 
     // Return error flag
@@ -993,123 +2168,205 @@ int RtfWriter::end_tablerow()
 }
 
 
-// Starts new RTF table cell
-int RtfWriter::start_tablecell(int rightMargin)
+// Writes complete RTF table row, cells holds row.cellCount cell texts
+int RtfWriter::write_tablerow(const RtfRowTemplate& row, const std::string_view* cells)
+{
+    RtfSink& sink = *_rtfSink;
+
+    // Writes RTF table data
+    sink.write( row.rowDefinition );
+    for ( size_t i=0; i<row.cellCount; i++ )
+    {
+        sink.write( row.cellPrefix );
+        write_narrowtext( sink, cells[i] );
+        sink.write( "\n\\cell " );
+    }
+
+    // Return error flag
+    return end_tablerow();
+}
+
+
+// Writes complete RTF table from columns, every column holds rowCount values
+int RtfWriter::write_table(const RtfTableColumn* columns, size_t columnCount, size_t rowCount)
 {
     // Set error flag
     int error = RTF_SUCCESS;
 
-    char tblcla[20]="";
-    // Format table cell text aligment
-    switch (_rtfCellFormat.textVerticalAligment)
+    // Cell right margins follow from column widths
+    _rtfTableCells.resize( columnCount );
+    _rtfTableMargins.resize( columnCount );
+    int rightMargin = _rtfRowFormat.rowLeftMargin;
+    for ( size_t i=0; i<columnCount; i++ )
     {
-        // Top align
-        case RTF_CELLTEXTALIGN_TOP:
-            strcpy( tblcla, "\\clvertalt" );
-            break;
+        const RTF_TABLECELL_FORMAT* cf = columns[i].cellFormat != NULL ? columns[i].cellFormat : &_rtfCellFormat;
+        memcpy( &_rtfTableCells[i], cf, sizeof(RTF_TABLECELL_FORMAT) );
+        rightMargin += columns[i].width;
+        _rtfTableMargins[i] = rightMargin;
+    }
 
-        // Center align
-        case RTF_CELLTEXTALIGN_CENTER:
-            strcpy( tblcla, "\\clvertalc" );
-            break;
+    if ( !compile_tablerow( _rtfTableRow, _rtfTableCells.data(), _rtfTableMargins.data(), columnCount ) )
+        return RTF_TABLE_ERROR;
 
-        // Bottom align
-        case RTF_CELLTEXTALIGN_BOTTOM:
-            strcpy( tblcla, "\\clvertalb" );
-            break;
+    // Decimal aligned columns get their own cell paragraph prefix
+    _rtfTablePrefixes.resize( columnCount );
+    _rtfTableNumbers.resize( columnCount );
+    for ( size_t i=0; i<columnCount; i++ )
+    {
+        const RTF_NUMBER_FORMAT* nf = columns[i].numberFormat;
+        _rtfTablePrefixes[i].clear();
+        if ( columns[i].columnType == RTF_COLUMNTYPE_STRING || nf == NULL || nf->decimalTab <= 0 )
+            continue;
+
+        RTF_PARAGRAPH_FORMAT pf;
+        memcpy( &pf, &_rtfParFormat, sizeof(RTF_PARAGRAPH_FORMAT) );
+        pf.newParagraph = false;
+        pf.tableText = true;
+        pf.paragraphTabs = true;
+        pf.TABS.tabKind = RTF_PARAGRAPHTABKIND_DECIMAL;
+        pf.TABS.tabLead = RTF_PARAGRAPHTABLEAD_NONE;
+        pf.TABS.tabPosition = nf->decimalTab;
+
+        RtfStringSink sink( _rtfTablePrefixes[i] );
+        write_paragraphprefix( sink, pf );
+        sink.write( "\\tab " );
     }
 
-    char tblcld[20];
-    // Format table cell text direction
-    switch (_rtfCellFormat.textDirection)
+    // Writes RTF table data, numbers are formatted column by column per batch
+    RtfSink& sink = *_rtfSink;
+    for ( size_t first=0; first<rowCount && error == RTF_SUCCESS; first+=RTF_TABLE_BATCHROWS )
     {
-        // Left to right, top to bottom
-        case RTF_CELLTEXTDIRECTION_LRTB:
-            strcpy( tblcld, "\\cltxlrtb" );
-            break;
+        size_t count = rowCount - first < RTF_TABLE_BATCHROWS ? rowCount - first : RTF_TABLE_BATCHROWS;
+        for ( size_t i=0; i<columnCount; i++ )
+        {
+            const RtfTableColumn& column = columns[i];
+            const RTF_NUMBER_FORMAT& nf = column.numberFormat != NULL ? *column.numberFormat : RtfNumberFormatter::default_format();
+            _rtfTableNumbers[i].clear();
+            if ( column.columnType == RTF_COLUMNTYPE_INT64 )
+                _rtfTableNumbers[i].format_column( column.integers + first, count, nf );
+            else if ( column.columnType == RTF_COLUMNTYPE_DOUBLE )
+                _rtfTableNumbers[i].format_column( column.doubles + first, count, nf );
+        }
+
+        for ( size_t row=0; row<count && error == RTF_SUCCESS; row++ )
+        {
+            sink.write( _rtfTableRow.rowDefinition );
+            for ( size_t i=0; i<columnCount; i++ )
+            {
+                const std::string& prefix = _rtfTablePrefixes[i];
+                sink.write( prefix.empty() ? _rtfTableRow.cellPrefix : prefix );
+                switch ( columns[i].columnType )
+                {
+                    case RTF_COLUMNTYPE_STRING:
+                        write_narrowtext( sink, columns[i].strings[first + row] );
+                        break;
+
+                    case RTF_COLUMNTYPE_INT64:
+                    case RTF_COLUMNTYPE_DOUBLE:
+                        sink.write( _rtfTableNumbers[i].get( row ) );
+                        break;
+                }
+                sink.write( "\n\\cell " );
+            }
+
+            error = end_tablerow();
+        }
+    }
+
+    // Return error flag
+    return error;
+}
 
-        // Right to left, top to bottom
-        case RTF_CELLTEXTDIRECTION_RLTB:
-            strcpy( tblcld, "\\cltxtbrl" );
-            break;
 
-        // Left to right, bottom to top
-        case RTF_CELLTEXTDIRECTION_LRBT:
-            strcpy( tblcld, "\\cltxbtlr" );
-            break;
+// Compiles RTF table row layout from row format, cell formats and current paragraph format
+bool RtfWriter::compile_tablerow(RtfRowTemplate& row, const RTF_TABLECELL_FORMAT* cellFormats, const int* rightMargins, size_t count)
+{
+    if ( count > 0 && ( cellFormats == NULL || rightMargins == NULL ) )
+        return false;
 
-        // Left to right, top to bottom, vertical
-        case RTF_CELLTEXTDIRECTION_LRTBV:
-            strcpy( tblcld, "\\cltxlrtbv" );
-            break;
+    row.rowDefinition.clear();
+    row.cellPrefix.clear();
+    row.cellCount = count;
 
-        // Right to left, top to bottom, vertical
-        case RTF_CELLTEXTDIRECTION_RLTBV:
-            strcpy( tblcld, "\\cltxtbrlv" );
-            break;
+    // Row and cell definitions
+    {
+        RtfStringSink sink( row.rowDefinition );
+        write_tablerowdef( sink, _rtfRowFormat );
+        for ( size_t i=0; i<count; i++ )
+            write_tablecelldef( sink, cellFormats[i], rightMargins[i] );
     }
 
-    char tbclbrb[1024]="", tbclbrl[1024]="", tbclbrr[1024]="", tbclbrt[1024]="";
-    // Format table cell border
-    if ( _rtfCellFormat.borderBottom.border == true )
+    // Cell text uses the current paragraph format inside the table
+    RTF_PARAGRAPH_FORMAT pf;
+    memcpy( &pf, &_rtfParFormat, sizeof(RTF_PARAGRAPH_FORMAT) );
+    pf.newParagraph = false;
+    pf.tableText = true;
     {
-        // Bottom cell border
-        char tbclbt[20];
-        strcpy( tbclbt, "\\clbrdrb" );
+        RtfStringSink sink( row.cellPrefix );
+        if ( pf.tabbedText == true )
+            sink.write( "\\tab " );
+        else
+            write_paragraphprefix( sink, pf );
+    }
 
-        char* border = RtfWriter::get_bordername(_rtfCellFormat.borderBottom.BORDERS.borderType);
+    return true;
+}
 
-        sprintf( tbclbrb, "%s%s\\brdrw%d\\brsp%d\\brdrcf%d", tbclbt, border, _rtfCellFormat.borderBottom.BORDERS.borderWidth,
-            _rtfCellFormat.borderBottom.BORDERS.borderSpace, _rtfCellFormat.borderBottom.BORDERS.borderColor );
-    }
-    if ( _rtfCellFormat.borderLeft.border == true )
-    {
-        // Left cell border
-        char tbclbt[20]="";
-        strcpy( tbclbt, "\\clbrdrl" );
 
-        char* border = RtfWriter::get_bordername(_rtfCellFormat.borderLeft.BORDERS.borderType);
+// Writes RTF table row definition
+void RtfWriter::write_tablerowdef(RtfSink& sink, const RTF_TABLEROW_FORMAT& rf)
+{
+    sink.write( "\n\\trowd\\trgaph115" );
 
-        sprintf( tbclbrl, "%s%s\\brdrw%d\\brsp%d\\brdrcf%d", tbclbt, border, _rtfCellFormat.borderLeft.BORDERS.borderWidth,
-        _rtfCellFormat.borderLeft.BORDERS.borderSpace, _rtfCellFormat.borderLeft.BORDERS.borderColor );
-    }
-    if ( _rtfCellFormat.borderRight.border == true )
-    {
-        // Right cell border
-        char tbclbt[20];
-        strcpy( tbclbt, "\\clbrdrr" );
+    // Format table row aligment
+    sink.write( rtf_lookup(rtfRowAlignNames, rf.rowAligment) );
+
+    sink.emit( "\\trleft", rf.rowLeftMargin );
+    sink.emit( "\\trrh", rf.rowHeight );
+    // Cell paddings keep the pairing of earlier versions: top margin goes to \trpaddb,
+    // bottom to \trpaddl, left to \trpaddr and right to \trpaddt
+    sink.emit( "\\trpaddb", rf.marginTop );
+    sink.emit( "\\trpaddfb", 3 );
+    sink.emit( "\\trpaddl", rf.marginBottom );
+    sink.emit( "\\trpaddfl", 3 );
+    sink.emit( "\\trpaddr", rf.marginLeft );
+    sink.emit( "\\trpaddfr", 3 );
+    sink.emit( "\\trpaddt", rf.marginRight );
+    sink.emit( "\\trpaddft", 3 );
+}
 
-        char* border = RtfWriter::get_bordername(_rtfCellFormat.borderRight.BORDERS.borderType);
 
-        sprintf( tbclbrr, "%s%s\\brdrw%d\\brsp%d\\brdrcf%d", tbclbt, border, _rtfCellFormat.borderRight.BORDERS.borderWidth,
-        _rtfCellFormat.borderRight.BORDERS.borderSpace, _rtfCellFormat.borderRight.BORDERS.borderColor );
-    }
-    if ( _rtfCellFormat.borderTop.border == true )
-    {
-        // Top cell border
-        char tbclbt[20];
-        strcpy( tbclbt, "\\clbrdrt" );
+// Ends RTF table row
+int RtfWriter::end_tablerow()
+{
+    // Set error flag
+    int error = RTF_SUCCESS;
 
-        char* border = RtfWriter::get_bordername(_rtfCellFormat.borderTop.BORDERS.borderType);
+    // Writes RTF table data
+    _rtfSink->write( "\n\\trgaph115\\row\\pard" );
 
-        sprintf( tbclbrt, "%s%s\\brdrw%d\\brsp%d\\brdrcf%d", tbclbt, border, _rtfCellFormat.borderTop.BORDERS.borderWidth,
-        _rtfCellFormat.borderTop.BORDERS.borderSpace, _rtfCellFormat.borderTop.BORDERS.borderColor );
-    }
+    // Paragraph state is reset by \pard
+    _rtfStateValid = false;
 
-    // Format table cell shading
-    char shading[100] = "";
-    if ( _rtfCellFormat.cellShading == true )
-    {
-        char* sh = RtfWriter::get_shadingname( _rtfCellFormat.SHADING.shadingType, true );
+    // Row is complete, let the sink apply its flush policy
+    _rtfSink->end_block();
+    if ( !_rtfSink->good() )
+        error = RTF_TABLE_ERROR;
 
-        // Set paragraph shading color
-        sprintf( shading, "%s\\clshdgn%d\\clcfpat%d\\clcbpat%d", sh, _rtfCellFormat.SHADING.shadingIntensity, _rtfCellFormat.SHADING.shadingFillColor, _rtfCellFormat.SHADING.shadingBkColor );
-    }
+    // Return error flag
+    return error;
+}
+
+
+// Starts new RTF table cell
+int RtfWriter::start_tablecell(int rightMargin)
+{
+    // Set error flag
+    int error = RTF_SUCCESS;
 
     // Writes RTF table data
-    char rtfText[1024];
-    sprintf( rtfText, "\n\\tcelld%s%s%s%s%s%s%s\\cellx%d", tblcla, tblcld, tbclbrb, tbclbrl, tbclbrr, tbclbrt, shading, rightMargin );
-    if ( fwrite( rtfText, 1, strlen(rtfText), _rtfFile ) < strlen(rtfText) )
+    write_tablecelldef( *_rtfSink, _rtfCellFormat, rightMargin );
+    if ( !_rtfSink->good() )
         error = RTF_TABLE_ERROR;
 
     // Return error flag
@@ -1117,6 +2374,52 @@ int RtfWriter::start_tablecell(int rightMargin)
 }
 
 
+// Writes RTF table cell definition
+void RtfWriter::write_tablecelldef(RtfSink& sink, const RTF_TABLECELL_FORMAT& cf, int rightMargin)
+{
+    sink.write( "\n\\tcelld" );
+
+    // Format table cell text aligment
+    sink.write( rtf_lookup(rtfCellAlignNames, cf.textVerticalAligment) );
+
+    // Format table cell text direction
+    sink.write( rtf_lookup(rtfCellDirectionNames, cf.textDirection) );
+
+    // Format table cell border
+    write_tablecellborder( sink, "\\clbrdrb", cf.borderBottom );
+    write_tablecellborder( sink, "\\clbrdrl", cf.borderLeft );
+    write_tablecellborder( sink, "\\clbrdrr", cf.borderRight );
+    write_tablecellborder( sink, "\\clbrdrt", cf.borderTop );
+
+    // Format table cell shading
+    if ( cf.cellShading == true )
+    {
+        sink.write( get_shadingname( cf.SHADING.shadingType, true ) );
+
+        // Set paragraph shading color
+        sink.emit( "\\clshdgn", cf.SHADING.shadingIntensity );
+        sink.emit( "\\clcfpat", cf.SHADING.shadingFillColor );
+        sink.emit( "\\clcbpat", cf.SHADING.shadingBkColor );
+    }
+
+    sink.emit( "\\cellx", rightMargin );
+}
+
+
+// Writes RTF table cell border
+void RtfWriter::write_tablecellborder(RtfSink& sink, std::string_view side, const RTF_TABLEBORDER_FORMAT& bf)
+{
+    if ( bf.border == false )
+        return;
+
+    sink.write( side );
+    sink.write( get_bordername(bf.BORDERS.borderType) );
+    sink.emit( "\\brdrw", bf.BORDERS.borderWidth );
+    sink.emit( "\\brsp", bf.BORDERS.borderSpace );
+    sink.emit( "\\brdrcf", bf.BORDERS.borderColor );
+}
+
+
 // Ends RTF table cell
 int RtfWriter::end_tablecell()
 {
@@ -1124,9 +2427,7 @@ int RtfWriter::end_tablecell()
     int error = RTF_SUCCESS;
 
     // Writes RTF table data
-    char rtfText[1024];
-    strcpy( rtfText, "\n\\cell " );
-    if ( fwrite( rtfText, 1, strlen(rtfText), _rtfFile ) < strlen(rtfText) )
+    if ( !_rtfSink->write( "\n\\cell " ) )
         error = RTF_TABLE_ERROR;
 
     // Return error flag
@@ -1167,266 +2468,37 @@ void RtfWriter::set_tablecellformat(RTF_TABLECELL_FORMAT* cf)
 
 
 // Gets border name
-char* RtfWriter::get_bordername(int border_type)
+std::string_view RtfWriter::get_bordername(int border_type)
 {
-    char* border = new char[20];
-
-    switch (border_type)
-    {
-        // Single-thickness border
-        case RTF_PARAGRAPHBORDERTYPE_STHICK:
-            strcpy( border, "\\brdrs" );
-            break;
-
-        // Double-thickness border
-        case RTF_PARAGRAPHBORDERTYPE_DTHICK:
-            strcpy( border, "\\brdrth" );
-            break;
-
-        // Shadowed border
-        case RTF_PARAGRAPHBORDERTYPE_SHADOW:
-            strcpy( border, "\\brdrsh" );
-            break;
-
-        // Double border
-        case RTF_PARAGRAPHBORDERTYPE_DOUBLE:
-            strcpy( border, "\\brdrdb" );
-            break;
-
-        // Dotted border
-        case RTF_PARAGRAPHBORDERTYPE_DOT:
-            strcpy( border, "\\brdrdot" );
-            break;
-
-        // Dashed border
-        case RTF_PARAGRAPHBORDERTYPE_DASH:
-            strcpy( border, "\\brdrdash" );
-            break;
-
-        // Hairline border
-        case RTF_PARAGRAPHBORDERTYPE_HAIRLINE:
-            strcpy( border, "\\brdrhair" );
-            break;
-
-        // Inset border
-        case RTF_PARAGRAPHBORDERTYPE_INSET:
-            strcpy( border, "\\brdrinset" );
-            break;
-
-        // Dashed border (small)
-        case RTF_PARAGRAPHBORDERTYPE_SDASH:
-            strcpy( border, "\\brdrdashsm" );
-            break;
-
-        // Dot-dashed border
-        case RTF_PARAGRAPHBORDERTYPE_DOTDASH:
-            strcpy( border, "\\brdrdashd" );
-            break;
-
-        // Dot-dot-dashed border
-        case RTF_PARAGRAPHBORDERTYPE_DOTDOTDASH:
-            strcpy( border, "\\brdrdashdd" );
-            break;
-
-        // Outset border
-        case RTF_PARAGRAPHBORDERTYPE_OUTSET:
-            strcpy( border, "\\brdroutset" );
-            break;
-
-        // Triple border
-        case RTF_PARAGRAPHBORDERTYPE_TRIPLE:
-            strcpy( border, "\\brdrtriple" );
-            break;
-
-        // Wavy border
-        case RTF_PARAGRAPHBORDERTYPE_WAVY:
-            strcpy( border, "\\brdrwavy" );
-            break;
-
-        // Double wavy border
-        case RTF_PARAGRAPHBORDERTYPE_DWAVY:
-            strcpy( border, "\\brdrwavydb" );
-            break;
-
-        // Striped border
-        case RTF_PARAGRAPHBORDERTYPE_STRIPED:
-            strcpy( border, "\\brdrdashdotstr" );
-            break;
-
-        // Embossed border
-        case RTF_PARAGRAPHBORDERTYPE_EMBOSS:
-            strcpy( border, "\\brdremboss" );
-            break;
-
-        // Engraved border
-        case RTF_PARAGRAPHBORDERTYPE_ENGRAVE:
-            strcpy( border, "\\brdrengrave" );
-            break;
-    }
-
-    return border;
+    return rtf_lookup(rtfBorderTypeNames, border_type);
 }
 
 
 // Gets shading name
-char* RtfWriter::get_shadingname(int shading_type, bool cell)
+std::string_view RtfWriter::get_shadingname(int shading_type, bool cell)
 {
-    char* shading = new char[20];
-
     if ( cell == false )
-    {
-        switch (shading_type)
-        {
-            // Fill shading
-            case RTF_PARAGRAPHSHADINGTYPE_FILL:
-                strcpy( shading, "" );
-                break;
-
-            // Horizontal background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_HORIZ:
-                strcpy( shading, "\\bghoriz" );
-                break;
-
-            // Vertical background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_VERT:
-                strcpy( shading, "\\bgvert" );
-                break;
-
-            // Forward diagonal background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_FDIAG:
-                strcpy( shading, "\\bgfdiag" );
-                break;
-
-            // Backward diagonal background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_BDIAG:
-                strcpy( shading, "\\bgbdiag" );
-                break;
-
-            // Cross background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_CROSS:
-                strcpy( shading, "\\bgcross" );
-                break;
-
-            // Diagonal cross background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_CROSSD:
-                strcpy( shading, "\\bgdcross" );
-                break;
-
-            // Dark horizontal background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_DHORIZ:
-                strcpy( shading, "\\bgdkhoriz" );
-                break;
-
-            // Dark vertical background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_DVERT:
-                strcpy( shading, "\\bgdkvert" );
-                break;
-
-            // Dark forward diagonal background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_DFDIAG:
-                strcpy( shading, "\\bgdkfdiag" );
-                break;
-
-            // Dark backward diagonal background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_DBDIAG:
-                strcpy( shading, "\\bgdkbdiag" );
-                break;
-
-            // Dark cross background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_DCROSS:
-                strcpy( shading, "\\bgdkcross" );
-                break;
-
-            // Dark diagonal cross background pattern
-            case RTF_PARAGRAPHSHADINGTYPE_DCROSSD:
-                strcpy( shading, "\\bgdkdcross" );
-                break;
-        }
-    }
+        return rtf_lookup(rtfParagraphShadingNames, shading_type);
     else
-    {
-        switch (shading_type)
-        {
-            // Fill shading
-            case RTF_CELLSHADINGTYPE_FILL:
-                strcpy( shading, "" );
-                break;
-
-            // Horizontal background pattern
-            case RTF_CELLSHADINGTYPE_HORIZ:
-                strcpy( shading, "\\clbghoriz" );
-                break;
-
-            // Vertical background pattern
-            case RTF_CELLSHADINGTYPE_VERT:
-                strcpy( shading, "\\clbgvert" );
-                break;
-
-            // Forward diagonal background pattern
-            case RTF_CELLSHADINGTYPE_FDIAG:
-                strcpy( shading, "\\clbgfdiag" );
-                break;
-
-            // Backward diagonal background pattern
-            case RTF_CELLSHADINGTYPE_BDIAG:
-                strcpy( shading, "\\clbgbdiag" );
-                break;
-
-            // Cross background pattern
-            case RTF_CELLSHADINGTYPE_CROSS:
-                strcpy( shading, "\\clbgcross" );
-                break;
-
-            // Diagonal cross background pattern
-            case RTF_CELLSHADINGTYPE_CROSSD:
-                strcpy( shading, "\\clbgdcross" );
-                break;
-
-            // Dark horizontal background pattern
-            case RTF_CELLSHADINGTYPE_DHORIZ:
-                strcpy( shading, "\\clbgdkhoriz" );
-                break;
-
-            // Dark vertical background pattern
-            case RTF_CELLSHADINGTYPE_DVERT:
-                strcpy( shading, "\\clbgdkvert" );
-                break;
-
-            // Dark forward diagonal background pattern
-            case RTF_CELLSHADINGTYPE_DFDIAG:
-                strcpy( shading, "\\clbgdkfdiag" );
-                break;
-
-            // Dark backward diagonal background pattern
-            case RTF_CELLSHADINGTYPE_DBDIAG:
-                strcpy( shading, "\\clbgdkbdiag" );
-                break;
-
-            // Dark cross background pattern
-            case RTF_CELLSHADINGTYPE_DCROSS:
-                strcpy( shading, "\\clbgdkcross" );
-                break;
-
-            // Dark diagonal cross background pattern
-            case RTF_CELLSHADINGTYPE_DCROSSD:
-                strcpy( shading, "\\clbgdkdcross" );
-                break;
-        }
-    }
+        return rtf_lookup(rtfCellShadingNames, shading_type);
+}
+
 
-    return shading;
+// Gets RTF document output sink
+RtfSink* RtfWriter::get_sink()
+{
+    return _rtfSink.get();
 }
 
 
 std::string         RtfWriter::encodeWString(const std::wstring& str)
 {
-    std::ostringstream sstr;
-    for (size_t i = 0; i < str.length(); i++)
-    {
-        if(str[i] <= 0x7f )
-            sstr  << (char) str[i];
-        else 
-            sstr<<"\\u" << str[i] << "?";//\uN and append the ansi representation of this char
-    }
-    return sstr.str();
+    std::string result;
+    result.reserve( str.length() );
+
+    // Escapes RTF special characters and writes non-ASCII characters as \uN?
+    RtfStringSink sink( result );
+    sink.write_text( std::wstring_view(str) );
+
+    return result;
 }
\ No newline at end of file
@@ -22,19 +22,64 @@ The above copyright notice and this permission notice shall be included in
 */
 
 #include "rtfdefs.h"
+#include "RtfSink.h"
+#include "RtfImageCache.h"
+#include "RtfNumberFormatter.h"
+#include <cstdint>
+#include <deque>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+//
+// Table row layout compiled once by RtfWriter::compile_tablerow
+struct RtfRowTemplate
+{
+    std::string         rowDefinition;									// Row and cell definitions
+    std::string         cellPrefix;										// Cell paragraph formatting properties
+    size_t              cellCount;										// Number of cells in the row
+};
+
+class RtfDocumentProfile;
+
+//
+// Column of a table written by RtfWriter::write_table
+struct RtfTableColumn
+{
+    int                         columnType;						// Column value type (RTF_COLUMNTYPE_*)
+    const std::string_view*     strings;						// String values of RTF_COLUMNTYPE_STRING
+    const int64_t*              integers;						// Integer values of RTF_COLUMNTYPE_INT64
+    const double*               doubles;						// Floating point values of RTF_COLUMNTYPE_DOUBLE
+    const RTF_TABLECELL_FORMAT* cellFormat;						// Cell format, NULL uses the current table cell format
+    int                         width;							// Column width in twips
+    const RTF_NUMBER_FORMAT*    numberFormat;					// Number format, NULL uses the shortest form
+};
 
 class RtfWriter
 {
     public:
         RtfWriter(const std::wstring& filename);
+        RtfWriter(std::unique_ptr<RtfSink> sink);
+        RtfWriter(const RtfDocumentProfile& profile, std::unique_ptr<RtfSink> sink);	// Opens document from profile, get_sink() is NULL or not good() on failure
         ~RtfWriter();
 
-        bool open(char* fonts, char* colors);
+        bool open(const char* fonts, const char* colors);
+        bool open(const RtfDocumentProfile& profile);						// Opens RTF document with pre-rendered prologue
+        bool reset(std::unique_ptr<RtfSink> sink);							// Completes current document, next document goes to sink
+        bool reopen();														// Starts next RTF document in the sink attached by reset
+        std::shared_ptr<const RtfDocumentProfile> create_profile();			// Captures tables and formatting as reusable document profile
         bool write_header();												// Writes RTF document header
         void init();														// Sets global RTF library params
-        void set_fonttable(char* fonts);									// Sets new RTF document font table
-        void set_colortable(char* colors);									// Sets new RTF document color table
+        void set_defaulttables();											// Sets default RTF document font and color tables
+        void set_fonttable(const char* fonts);								// Sets new RTF document font table
+        void set_colortable(const char* colors);							// Sets new RTF document color table
+        int add_font(const char* name, int family = RTF_FONTFAMILY_NIL, int charset = 0);	// Adds font to font table, returns its index
+        int add_color(int red, int green, int blue);						// Adds color to color table, returns its index
+        int add_style(const char* name, const RTF_PARAGRAPH_FORMAT* pf);		// Adds paragraph style to the style sheet, returns its number or 0 on error
+        void set_paragraphstyle(int style);									// Sets style of following paragraphs
+        int get_paragraphstyle();											// Gets style of following paragraphs
         RTF_DOCUMENT_FORMAT* get_documentformat();							// Gets RTF document formatting properties
         void set_documentformat(RTF_DOCUMENT_FORMAT* df);					// Sets RTF document formatting properties
         bool write_documentformat();										// Writes RTF document formatting properties
@@ -45,11 +90,38 @@ class RtfWriter
         RTF_PARAGRAPH_FORMAT* get_paragraphformat();						// Gets RTF paragraph formatting properties
         void set_paragraphformat(RTF_PARAGRAPH_FORMAT* pf);					// Sets RTF paragraph formatting properties
         bool write_paragraphformat();										// Writes RTF paragraph formatting properties
+        void set_minimaloutput(bool minimal);								// Emits only changed paragraph and character properties
+        bool get_minimaloutput();											// Gets minimal output mode
+        void set_deferredheader(bool deferred);								// Writes only used fonts and colors, header follows the body
+        bool get_deferredheader();											// Gets deferred header mode
+        void set_filebackend(int backend);									// Sets backend of documents opened by file name
+        int get_filebackend();												// Gets backend of documents opened by file name
         int start_paragraph(const char* text, bool newPar);						// Starts new RTF paragraph
-        int load_image(char* image, int width, int height);					// Loads image from file
+        int start_paragraph(const char* text, size_t length, bool newPar);		// Starts new RTF paragraph
+        int start_paragraph(std::string_view text, bool newPar);				// Starts new RTF paragraph
+        int start_paragraph(std::u16string_view text, bool newPar);			// Starts new RTF paragraph with UTF-16 text
+        int start_paragraph(std::wstring_view text, bool newPar);				// Starts new RTF paragraph with wide text
+        int start_paragraph(int format, std::string_view text, bool newPar);	// Starts new RTF paragraph with registered format
+        int append_run(std::string_view text, const RTF_CHARACTER_FORMAT* cf);	// Appends text run with own character format to current paragraph
+        int append_run(std::wstring_view text, const RTF_CHARACTER_FORMAT* cf);	// Appends wide text run with own character format to current paragraph
+        int append_rtf(std::string_view rtf);								// Appends RTF code as is to current paragraph
+        int push_format(const RTF_CHARACTER_FORMAT* cf = NULL);			// Opens format group, optionally with new character format
+        int pop_format();													// Closes format group and restores formatting
+        int register_paragraphformat(const RTF_PARAGRAPH_FORMAT* pf);		// Registers paragraph format, returns its handle
+        RTF_PARAGRAPH_FORMAT* edit_paragraphformat(int format);			// Gets registered paragraph format for changing until the next writer call
+        bool update_paragraphformat(int format, const RTF_PARAGRAPH_FORMAT* pf);	// Replaces registered paragraph format
+        void set_textencoding(int encoding);								// Sets encoding of narrow paragraph text
+        int get_textencoding();												// Gets encoding of narrow paragraph text
+        int load_image(char* image, int width, int height);					// Embeds PNG or JPEG image from file
         char* bin_hex_convert(unsigned char* binary, int size);				// Converts binary data to hex
+        void set_imagecache(RtfImageCache* cache);							// Sets encoded image cache, NULL (the default) streams every image
+        RtfImageCache* get_imagecache();									// Gets encoded image cache
         void set_defaultformat();											// Sets default RTF document formatting
         int start_tablerow();												// Starts new RTF table row
+        int start_tablerow(const RtfRowTemplate& row);						// Starts new RTF table row with compiled cell definitions
+        int write_tablerow(const RtfRowTemplate& row, const std::string_view* cells);	// Writes complete RTF table row
+        int write_table(const RtfTableColumn* columns, size_t columnCount, size_t rowCount);	// Writes complete RTF table from columns
+        bool compile_tablerow(RtfRowTemplate& row, const RTF_TABLECELL_FORMAT* cellFormats, const int* rightMargins, size_t count);	// Compiles RTF table row layout
         int end_tablerow();													// Ends RTF table row
         int start_tablecell(int rightMargin);								// Starts new RTF table cell
         int end_tablecell();												// Ends RTF table cell
@@ -57,14 +129,85 @@ class RtfWriter
         void set_tablerowformat(RTF_TABLEROW_FORMAT* rf);					// Sets RTF table row formatting properties
         RTF_TABLECELL_FORMAT* get_tablecellformat();						// Gets RTF table cell formatting properties
         void set_tablecellformat(RTF_TABLECELL_FORMAT* cf);					// Sets RTF table cell formatting properties
-        char* get_bordername(int border_type);								// Gets border name
-        char* get_shadingname(int shading_type, bool cell);					// Gets shading name
+        std::string_view get_bordername(int border_type);					// Gets border name
+        std::string_view get_shadingname(int shading_type, bool cell);		// Gets shading name
+        RtfSink* get_sink();												// Gets RTF document output sink
 
         //
-        // helper method to convert unicode string to ansi string
+        // helper method to convert unicode string to RTF encoded ansi string
         static  std::string             encodeWString(const std::wstring& str);
 
     private:
+        friend class RtfDocumentProfile;
+
+        struct RtfStyle
+        {
+            std::string          name;							// Style name
+            RTF_PARAGRAPH_FORMAT format;						// Style paragraph and character format
+        };
+
+        struct RtfFont
+        {
+            std::string          name;							// Font name
+            int                  family;						// Font family (RTF_FONTFAMILY_*)
+            int                  charset;						// Font character set
+        };
+
+        struct RtfTables
+        {
+            std::string          fontTable;						// Rendered font table entries
+            std::string          colorTable;					// Rendered color table entries
+            std::string          styleSheet;					// Rendered style sheet
+            std::vector<RtfFont> fonts;							// Font table entries
+            std::vector<unsigned long> colors;					// Color table entries as 0xRRGGBB
+            std::unordered_map<std::string, int> fontIndex;		// Font table index by name, family and charset
+            std::unordered_map<unsigned long, int> colorIndex;	// Color table index by 0xRRGGBB
+            std::vector<RtfStyle> styles;						// Paragraph styles, style N at index N-1
+        };
+
+        struct RtfFormatEntry
+        {
+            RTF_PARAGRAPH_FORMAT format;						// Registered paragraph format
+            std::string          prefix;						// Rendered paragraph prefix without \par
+            int                  style;							// Paragraph style the prefix was rendered with
+            bool                 dirty;							// Prefix must be rendered again
+        };
+
+        struct RtfFormatFrame
+        {
+            RTF_PARAGRAPH_FORMAT format;						// Paragraph format at push_format
+            RTF_CHARACTER_FORMAT runFormat;						// Character format of current paragraph at push_format
+            int                  style;							// Paragraph style at push_format
+        };
+
+        bool write_header(RtfSink& sink, std::string_view fonts, std::string_view colors, std::string_view styles);
+        bool start_document();												// Creates document sink, buffers the body of deferred document
+        bool write_documentformat(RtfSink& sink);
+        bool write_sectionformat(RtfSink& sink);
+        bool write_documentend();											// Completes and closes RTF document
+        bool write_deferred();												// Writes header and renumbered body of deferred document
+        void write_fontentry(RtfSink& sink, int number, const RtfFont& font);
+        void write_colorentry(RtfSink& sink, unsigned long rgb);
+        bool write_paragraph(std::string_view paragraphText);				// Writes RTF paragraph formatting properties and text
+        void write_paragraphstart();										// Writes RTF paragraph formatting properties
+        void remember_paragraph(const RTF_PARAGRAPH_FORMAT& pf);			// Remembers emitted paragraph state for the delta path
+        bool write_paragraphend();											// Completes RTF paragraph
+        RtfTables& edit_tables();											// Gets tables for modification, copied while shared
+        int append_font(const RtfFont& font);								// Appends font table entry
+        int append_color(unsigned long rgb);								// Appends color table entry
+        bool write_runstart(const RTF_CHARACTER_FORMAT* cf);				// Opens text run group
+        void write_paragraphprefix(RtfSink& sink, const RTF_PARAGRAPH_FORMAT& pf);
+        void write_paragraphproperties(RtfSink& sink, const RTF_PARAGRAPH_FORMAT& pf);
+        void write_paragraphdelta(RtfSink& sink, const RTF_PARAGRAPH_FORMAT& last, const RTF_PARAGRAPH_FORMAT& pf);
+        bool write_propertydelta(RtfSink& sink, const RTF_PARAGRAPH_FORMAT& last, const RTF_PARAGRAPH_FORMAT& pf);
+        void write_narrowtext(RtfSink& sink, std::string_view text);		// Writes narrow text in the current text encoding
+        void write_characterformat(RtfSink& sink, const RTF_CHARACTER_FORMAT& cf);
+        bool write_characterdelta(RtfSink& sink, const RTF_CHARACTER_FORMAT& from, const RTF_CHARACTER_FORMAT& to);
+        void write_tablerowdef(RtfSink& sink, const RTF_TABLEROW_FORMAT& rf);
+        void write_tablecelldef(RtfSink& sink, const RTF_TABLECELL_FORMAT& cf, int rightMargin);
+        void write_tablecellborder(RtfSink& sink, std::string_view side, const RTF_TABLEBORDER_FORMAT& bf);
+        bool write_picture(RtfSink& sink, FILE* file, const RTF_IMAGE_INFO& info, int width, int height);
+
         std::wstring        _filename;
 
         RTF_DOCUMENT_FORMAT  _rtfDocFormat;					// RTF document formatting params
@@ -72,10 +215,59 @@ class RtfWriter
         RTF_PARAGRAPH_FORMAT _rtfParFormat;					// RTF paragraph formatting params
         RTF_TABLEROW_FORMAT  _rtfRowFormat;					// RTF table row formatting params
         RTF_TABLECELL_FORMAT _rtfCellFormat;					// RTF table cell formatting params
-        std::string          _rtfFontTable;
-        std::string          _rtfColorTable;
+        std::shared_ptr<const RtfTables> _rtfTables;			// Font, color and style tables, shared with profiles
+        int                  _rtfTextEncoding;					// Encoding of narrow paragraph text
+        bool                 _rtfMinimalOutput;				// Emit only changed properties
+        bool                 _rtfDeferredHeader;				// Header is written after the body
+        int                  _rtfFileBackend;					// Backend of documents opened by file name (RTF_FILEBACKEND_*)
+        std::string          _rtfBody;							// Buffered body of deferred document
+        bool                 _rtfOpen;							// Document is started and not completed
+        bool                 _rtfStateValid;					// Last emitted paragraph state is known
+        RTF_PARAGRAPH_FORMAT _rtfLastFormat;					// Last emitted paragraph formatting params
+        RTF_CHARACTER_FORMAT _rtfRunFormat;					// Character format of current paragraph
+        int                  _rtfParagraphStyle;				// Style of following paragraphs, 0 for none
+        int                  _rtfLastStyle;					// Style of last emitted paragraph
+        std::deque<RtfFormatEntry> _rtfFormats;				// Registered paragraph formats, handle N at index N-1
+        RtfFormatFrame       _rtfFormatStack[RTF_MAX_FORMAT_DEPTH];	// Formatting saved by push_format
+        int                  _rtfFormatDepth;					// Number of open format groups
+        RtfImageCache*       _rtfImageCache;					// Encoded image cache
+        RtfRowTemplate       _rtfTableRow;						// Row template of write_table
+        std::vector<RTF_TABLECELL_FORMAT> _rtfTableCells;		// Cell formats of write_table
+        std::vector<int>     _rtfTableMargins;					// Cell right margins of write_table
+        std::vector<std::string> _rtfTablePrefixes;				// Cell paragraph prefixes of write_table
+        std::vector<RtfNumberFormatter> _rtfTableNumbers;		// Formatted number batches of write_table
         // RTF library global params
-        FILE*               _rtfFile;
-        //IPicture*           _rtfPicture;
+        std::unique_ptr<RtfSink> _rtfSink;					// RTF document output sink
+        std::unique_ptr<RtfSink> _rtfTarget;					// Document sink while the body is buffered
+        std::unique_ptr<RtfSink> _rtfSpare;					// Completed sink, kept only for its buffer to be reused by the next one
 };
 
+
+//
+// Immutable document prologue created by RtfWriter::create_profile. The header,
+// document and section formatting are rendered once, writers opened from the
+// profile copy them with a single write. Font, color and style tables are shared
+// with those writers until one of them adds to a table. May be shared between threads.
+class RtfDocumentProfile
+{
+    friend class RtfWriter;
+
+    public:
+        std::string_view get_prologue() const;								// Gets pre-rendered document prologue
+
+    private:
+        RtfDocumentProfile() {}
+
+        std::string          _rtfPrologue;						// Header, document and section formatting
+        RTF_DOCUMENT_FORMAT  _rtfDocFormat;					// RTF document formatting params
+        RTF_SECTION_FORMAT   _rtfSecFormat;					// RTF section formatting params
+        RTF_PARAGRAPH_FORMAT _rtfParFormat;					// RTF paragraph formatting params
+        RTF_TABLEROW_FORMAT  _rtfRowFormat;					// RTF table row formatting params
+        RTF_TABLECELL_FORMAT _rtfCellFormat;					// RTF table cell formatting params
+        std::shared_ptr<const RtfWriter::RtfTables> _rtfTables;	// Font, color and style tables, shared with writers
+        std::deque<RtfWriter::RtfFormatEntry> _rtfFormats;	// Registered paragraph formats, handle N at index N-1
+        int                  _rtfTextEncoding;					// Encoding of narrow paragraph text
+        bool                 _rtfMinimalOutput;				// Emit only changed properties
+        bool                 _rtfDeferredHeader;				// Header is written after the body
+        int                  _rtfParagraphStyle;				// Style of following paragraphs, 0 for none
+};
@@ -0,0 +1,177 @@
+/*
+Copyright (c) <year> <copyright holders>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+#ifdef _MSC_VER
+#include "StdAfx.h"
+#endif
+#include "RtfImageCache.h"
+#include <sys/stat.h>
+
+RtfImageCache::RtfImageCache(size_t budget): _size(0), _budget(budget)
+{
+
+}
+
+
+// Gets process-wide image cache
+RtfImageCache& RtfImageCache::global()
+{
+    static RtfImageCache cache;
+    return cache;
+}
+
+
+// Builds cache key for opened image file
+bool RtfImageCache::make_key(FILE* file, const char* image, int width, int height, std::string& key, size_t& fileSize)
+{
+    // The opened file is described, not whatever the path names by now
+#ifdef _WIN32
+    struct _stat64 st;
+    if ( _fstat64( _fileno(file), &st ) != 0 )
+        return false;
+#else
+    struct stat st;
+    if ( fstat( fileno(file), &st ) != 0 )
+        return false;
+#endif
+
+    // Modified or replaced files get a new key
+    key = image;
+    key += '\n';
+    key += std::to_string( (unsigned long long)st.st_dev );
+    key += ':';
+    key += std::to_string( (unsigned long long)st.st_ino );
+    key += '\n';
+#if defined(__linux__)
+    key += std::to_string( (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec );
+#elif defined(__APPLE__)
+    key += std::to_string( (long long)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec );
+#else
+    key += std::to_string( (long long)st.st_mtime );
+#endif
+    key += '\n';
+    key += std::to_string( (unsigned long long)st.st_size );
+    key += '\n';
+    key += std::to_string( width );
+    key += 'x';
+    key += std::to_string( height );
+
+    fileSize = (size_t)st.st_size;
+    return true;
+}
+
+
+// Gets cached picture group
+std::shared_ptr<const std::string> RtfImageCache::find(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock( _mutex );
+
+    auto it = _index.find( key );
+    if ( it == _index.end() )
+        return std::shared_ptr<const std::string>();
+
+    // Move entry to the front of the LRU list
+    _entries.splice( _entries.begin(), _entries, it->second );
+    return it->second->second;
+}
+
+
+// Adds picture group to the cache
+bool RtfImageCache::insert(const std::string& key, std::shared_ptr<const std::string> group)
+{
+    if ( !group || !fits( group->size() ) )
+        return false;
+
+    std::lock_guard<std::mutex> lock( _mutex );
+
+    // Another thread may have cached the same image meanwhile
+    auto it = _index.find( key );
+    if ( it != _index.end() )
+    {
+        _size -= it->second->second->size();
+        _entries.erase( it->second );
+        _index.erase( it );
+    }
+
+    _entries.emplace_front( key, group );
+    _index[key] = _entries.begin();
+    _size += group->size();
+
+    evict();
+    return true;
+}
+
+
+// Group of this size may be cached, a single group takes at most a fraction of the budget
+bool RtfImageCache::fits(size_t size)
+{
+    std::lock_guard<std::mutex> lock( _mutex );
+    return size <= _budget / RTF_IMAGECACHE_ENTRYSHARE;
+}
+
+
+// Removes all cached groups
+void RtfImageCache::clear()
+{
+    std::lock_guard<std::mutex> lock( _mutex );
+
+    _index.clear();
+    _entries.clear();
+    _size = 0;
+}
+
+
+// Sets cache byte budget
+void RtfImageCache::set_budget(size_t budget)
+{
+    std::lock_guard<std::mutex> lock( _mutex );
+
+    _budget = budget;
+    evict();
+}
+
+
+// Gets cache byte budget
+size_t RtfImageCache::get_budget()
+{
+    std::lock_guard<std::mutex> lock( _mutex );
+    return _budget;
+}
+
+
+// Gets cached bytes
+size_t RtfImageCache::get_size()
+{
+    std::lock_guard<std::mutex> lock( _mutex );
+    return _size;
+}
+
+
+// Drops entries until within budget
+void RtfImageCache::evict()
+{
+    while ( _size > _budget && !_entries.empty() )
+    {
+        _size -= _entries.back().second->size();
+        _index.erase( _entries.back().first );
+        _entries.pop_back();
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+/*
+Copyright (c) <year> <copyright holders>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "rtfdefs.h"
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+//
+// Process-wide cache of encoded \pict groups. Entries are keyed by image
+// path, file identity, modification time, file size and scaling, and evicted
+// in least recently used order once the byte budget is exceeded. Groups larger
+// than 1/RTF_IMAGECACHE_ENTRYSHARE of the budget are not cached. All methods are
+// thread safe; returned groups stay valid after eviction. Writers use a
+// cache only after RtfWriter::set_imagecache, otherwise images are streamed.
+class RtfImageCache
+{
+    public:
+        RtfImageCache(size_t budget = RTF_IMAGECACHE_BUDGET);
+
+        static RtfImageCache& global();										// Gets process-wide image cache
+
+        static bool make_key(FILE* file, const char* image, int width, int height, std::string& key, size_t& fileSize);	// Builds cache key for opened image file
+        std::shared_ptr<const std::string> find(const std::string& key);	// Gets cached picture group
+        bool insert(const std::string& key, std::shared_ptr<const std::string> group);	// Adds picture group to the cache
+        bool fits(size_t size);												// Group of this size may be cached
+        void clear();														// Removes all cached groups
+        void set_budget(size_t budget);										// Sets cache byte budget
+        size_t get_budget();												// Gets cache byte budget
+        size_t get_size();													// Gets cached bytes
+
+    private:
+        typedef std::pair< std::string, std::shared_ptr<const std::string> > Entry;
+
+        void evict();														// Drops entries until within budget
+
+        std::mutex          _mutex;
+        std::list<Entry>    _entries;										// Most recently used first
+        std::unordered_map< std::string, std::list<Entry>::iterator > _index;
+        size_t              _size;
+        size_t              _budget;
+
+        RtfImageCache(const RtfImageCache&);
+        RtfImageCache& operator=(const RtfImageCache&);
+};
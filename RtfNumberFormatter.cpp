@@ -0,0 +1,179 @@
+/*
+Copyright (c) <year> <copyright holders>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+#ifdef _MSC_VER
+#include "StdAfx.h"
+#endif
+#include "RtfNumberFormatter.h"
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+// Shortest round-trip form without grouping
+static const RTF_NUMBER_FORMAT rtfDefaultNumberFormat = { -1, false, ',', '.', false, false, 0 };
+
+// Writes sign, grouped digits and suffixes of formatted magnitude
+static size_t rtf_decorate(char* out, const char* digits, size_t length, bool negative, const RTF_NUMBER_FORMAT& nf)
+{
+    char* p = out;
+
+    if ( negative )
+        *p++ = nf.negativeParentheses ? '(' : '-';
+
+    // Integer part ends at the decimal point or exponent
+    size_t integer = 0;
+    while ( integer < length && digits[integer] >= '0' && digits[integer] <= '9' )
+        integer++;
+
+    for ( size_t i=0; i<length; i++ )
+    {
+        if ( nf.thousandsSeparator && i > 0 && i < integer && (integer - i) % 3 == 0 )
+            *p++ = nf.separatorChar;
+        *p++ = ( digits[i] == '.' ) ? nf.decimalChar : digits[i];
+    }
+
+    if ( nf.percent )
+        *p++ = '%';
+    if ( negative && nf.negativeParentheses )
+        *p++ = ')';
+
+    return p - out;
+}
+
+RtfNumberFormatter::RtfNumberFormatter()
+{
+    _offsets.push_back( 0 );
+}
+
+
+// Gets shortest form without grouping
+const RTF_NUMBER_FORMAT& RtfNumberFormatter::default_format()
+{
+    return rtfDefaultNumberFormat;
+}
+
+
+// Formats floating point number
+size_t RtfNumberFormatter::format(char* out, double value, const RTF_NUMBER_FORMAT& nf)
+{
+    // Not a number and infinity are written as is
+    if ( !std::isfinite( value ) )
+    {
+        std::to_chars_result result = std::to_chars( out, out + RTF_NUMBER_MAXLENGTH, value );
+        return result.ptr - out;
+    }
+
+    if ( nf.percent )
+        value *= 100;
+    bool negative = value < 0;
+    double magnitude = std::fabs( value );
+
+    // Digits leave room for sign, separators and suffixes
+    char digits[RTF_NUMBER_MAXLENGTH / 2];
+    std::to_chars_result result;
+    if ( nf.precision >= 0 )
+    {
+        int precision = nf.precision < RTF_NUMBER_MAXPRECISION ? nf.precision : RTF_NUMBER_MAXPRECISION;
+        result = std::to_chars( digits, digits + sizeof(digits), magnitude, std::chars_format::fixed, precision );
+    }
+    else
+        result = std::to_chars( digits, digits + sizeof(digits), magnitude );
+    if ( result.ec != std::errc() )
+        result = std::to_chars( digits, digits + sizeof(digits), magnitude, std::chars_format::scientific );
+
+    // Rounding may leave negative zero
+    size_t length = result.ptr - digits;
+    if ( negative && std::string_view( digits, length ).find_first_not_of( "0." ) == std::string_view::npos )
+        negative = false;
+
+    return rtf_decorate( out, digits, length, negative, nf );
+}
+
+
+// Formats integer number
+size_t RtfNumberFormatter::format(char* out, int64_t value, const RTF_NUMBER_FORMAT& nf)
+{
+    bool negative = value < 0;
+    uint64_t magnitude = negative ? 0 - (uint64_t)value : (uint64_t)value;
+
+    char digits[48];
+    char* p = std::to_chars( digits, digits + 24, magnitude ).ptr;
+
+    // Multiply by 100 without overflow
+    if ( nf.percent && magnitude != 0 )
+    {
+        *p++ = '0';
+        *p++ = '0';
+    }
+
+    // Fixed precision fraction keeps decimal points aligned with doubles
+    if ( nf.precision > 0 )
+    {
+        int precision = nf.precision < RTF_NUMBER_MAXPRECISION ? nf.precision : RTF_NUMBER_MAXPRECISION;
+        *p++ = '.';
+        memset( p, '0', precision );
+        p += precision;
+    }
+
+    return rtf_decorate( out, digits, p - digits, negative, nf );
+}
+
+
+// Removes formatted numbers, the arena is kept for reuse
+void RtfNumberFormatter::clear()
+{
+    _offsets.resize( 1 );
+}
+
+
+// Appends formatted column values
+void RtfNumberFormatter::format_column(const double* values, size_t count, const RTF_NUMBER_FORMAT& nf)
+{
+    _offsets.reserve( _offsets.size() + count );
+    for ( size_t i=0; i<count; i++ )
+    {
+        size_t length = format( reserve(), values[i], nf );
+        _offsets.push_back( _offsets.back() + length );
+    }
+}
+
+
+// Appends formatted column values
+void RtfNumberFormatter::format_column(const int64_t* values, size_t count, const RTF_NUMBER_FORMAT& nf)
+{
+    _offsets.reserve( _offsets.size() + count );
+    for ( size_t i=0; i<count; i++ )
+    {
+        size_t length = format( reserve(), values[i], nf );
+        _offsets.push_back( _offsets.back() + length );
+    }
+}
+
+
+// Makes room for one more number at the end of the arena
+char* RtfNumberFormatter::reserve()
+{
+    // Arena only grows, its used part ends at the last offset
+    size_t start = _offsets.back();
+    if ( _arena.size() < start + RTF_NUMBER_MAXLENGTH )
+        _arena.resize( 2 * ( start + RTF_NUMBER_MAXLENGTH ) );
+    return &_arena[start];
+}
@@ -0,0 +1,64 @@
+#pragma once
+/*
+Copyright (c) <year> <copyright holders>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "rtfdefs.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//
+// Locale independent number formatter for table cells. Whole column
+// batches are formatted into an arena which the table writer then copies
+// cell by cell.
+class RtfNumberFormatter
+{
+    public:
+        RtfNumberFormatter();
+
+        static const RTF_NUMBER_FORMAT& default_format();					// Gets shortest form without grouping
+        static size_t format(char* out, double value, const RTF_NUMBER_FORMAT& nf);		// Formats number, out holds RTF_NUMBER_MAXLENGTH
+        static size_t format(char* out, int64_t value, const RTF_NUMBER_FORMAT& nf);	// Formats number, out holds RTF_NUMBER_MAXLENGTH
+
+        void clear();														// Removes formatted numbers
+        void format_column(const double* values, size_t count, const RTF_NUMBER_FORMAT& nf);	// Appends formatted column values
+        void format_column(const int64_t* values, size_t count, const RTF_NUMBER_FORMAT& nf);	// Appends formatted column values
+        size_t get_count() const;											// Gets number of formatted numbers
+        std::string_view get(size_t index) const;							// Gets formatted number
+
+    private:
+        char* reserve();													// Makes room for one more number
+
+        std::string         _arena;
+        std::vector<size_t> _offsets;										// Start of every number plus end of the last one
+};
+
+inline size_t RtfNumberFormatter::get_count() const
+{
+    return _offsets.size() - 1;
+}
+
+inline std::string_view RtfNumberFormatter::get(size_t index) const
+{
+    return std::string_view( _arena.data() + _offsets[index], _offsets[index+1] - _offsets[index] );
+}
@@ -0,0 +1,1669 @@
+/*
+Copyright (c) <year> <copyright holders>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+#ifdef _MSC_VER
+#include "StdAfx.h"
+#endif
+#include "RtfSink.h"
+#include <charconv>
+#include <errno.h>
+#include <utility>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// SIMD paths, the scalar code handles the tails. GCC and Clang on x86 build the
+// SSSE3 and AVX2 paths with target attributes and pick them when the CPU supports
+// them. Other compilers use them only when enabled at compile time, e.g. /arch:AVX2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RTF_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(RTF_HAVE_SSE2) && defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define RTF_HAVE_SSSE3
+#define RTF_HAVE_AVX2
+#define RTF_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#else
+#define RTF_TARGET(isa)
+#if defined(__SSSE3__) || defined(__AVX__)
+#define RTF_HAVE_SSSE3
+#include <tmmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define RTF_HAVE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+// Preallocation and page cache advice
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define RTF_HAVE_FADVISE
+#endif
+
+// io_uring system calls, the C library may not wrap them
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#define RTF_HAVE_URING
+#endif
+
+// Lower case hex digits
+static const char rtfHexDigits[] = "0123456789abcdef";
+
+// CPU supports instruction set, checked once
+#if defined(RTF_HAVE_SSSE3) && !defined(__SSSE3__) && !defined(__AVX__) && defined(__GNUC__)
+static bool rtf_cpu_ssse3()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "ssse3" );
+}
+static const bool rtfCpuSsse3 = rtf_cpu_ssse3();
+#define RTF_CPU_SSSE3 rtfCpuSsse3
+#else
+#define RTF_CPU_SSSE3 true
+#endif
+#if defined(RTF_HAVE_AVX2) && !defined(__AVX2__) && defined(__GNUC__)
+static bool rtf_cpu_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "avx2" );
+}
+static const bool rtfCpuAvx2 = rtf_cpu_avx2();
+#define RTF_CPU_AVX2 rtfCpuAvx2
+#else
+#define RTF_CPU_AVX2 true
+#endif
+
+// Index of lowest set bit
+static inline unsigned rtf_ctz(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward( &index, mask );
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz( mask );
+#endif
+}
+
+// Character needs escaping or encoding in RTF text
+static inline bool rtf_special(unsigned long c)
+{
+    return c < 0x20 || c >= 0x80 || c == '\\' || c == '{' || c == '}';
+}
+
+#ifdef RTF_HAVE_AVX2
+// Length of leading plain UTF-8 run in whole 32 byte blocks
+RTF_TARGET("avx2") static size_t rtf_plain_blocks_avx2(const char* text, size_t size)
+{
+    const __m256i space = _mm256_set1_epi8( 0x20 );
+    const __m256i backslash = _mm256_set1_epi8( '\\' );
+    const __m256i open = _mm256_set1_epi8( '{' );
+    const __m256i close = _mm256_set1_epi8( '}' );
+    size_t i = 0;
+    for ( ; i + 32 <= size; i += 32 )
+    {
+        // Signed compare flags control characters and all non-ASCII bytes
+        __m256i v = _mm256_loadu_si256( (const __m256i*)(text + i) );
+        __m256i special = _mm256_or_si256( _mm256_cmpgt_epi8( space, v ),
+            _mm256_or_si256( _mm256_cmpeq_epi8( v, backslash ),
+            _mm256_or_si256( _mm256_cmpeq_epi8( v, open ), _mm256_cmpeq_epi8( v, close ) ) ) );
+        if ( _mm256_movemask_epi8( special ) != 0 )
+            break;
+    }
+
+    return i;
+}
+#endif
+
+// Length of leading UTF-8 run which can be copied verbatim
+static size_t rtf_plain_run(const char* text, size_t size)
+{
+    size_t i = 0;
+
+#ifdef RTF_HAVE_AVX2
+    // Stops at the block with the first special character, located below
+    if ( RTF_CPU_AVX2 )
+        i = rtf_plain_blocks_avx2( text, size );
+#endif
+
+#ifdef RTF_HAVE_SSE2
+    const __m128i space = _mm_set1_epi8( 0x20 );
+    const __m128i backslash = _mm_set1_epi8( '\\' );
+    const __m128i open = _mm_set1_epi8( '{' );
+    const __m128i close = _mm_set1_epi8( '}' );
+    for ( ; i + 16 <= size; i += 16 )
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(text + i) );
+        __m128i special = _mm_or_si128( _mm_cmpgt_epi8( space, v ),
+            _mm_or_si128( _mm_cmpeq_epi8( v, backslash ),
+            _mm_or_si128( _mm_cmpeq_epi8( v, open ), _mm_cmpeq_epi8( v, close ) ) ) );
+        unsigned mask = (unsigned)_mm_movemask_epi8( special );
+        if ( mask != 0 )
+            return i + rtf_ctz( mask );
+    }
+#endif
+
+    while ( i < size && !rtf_special( (unsigned char)text[i] ) )
+        i++;
+
+    return i;
+}
+
+// Narrows leading run of plain UTF-16 code units into out, returns run length
+static size_t rtf_narrow_run(const char16_t* text, size_t size, char* out)
+{
+    size_t i = 0;
+
+#ifdef RTF_HAVE_SSE2
+    const __m128i space = _mm_set1_epi16( 0x20 );
+    const __m128i del = _mm_set1_epi16( 0x7f );
+    const __m128i backslash = _mm_set1_epi16( '\\' );
+    const __m128i open = _mm_set1_epi16( '{' );
+    const __m128i close = _mm_set1_epi16( '}' );
+    for ( ; i + 8 <= size; i += 8 )
+    {
+        // Signed compare flags units 0x8000 and above together with control characters
+        __m128i v = _mm_loadu_si128( (const __m128i*)(text + i) );
+        __m128i special = _mm_or_si128( _mm_or_si128( _mm_cmplt_epi16( v, space ), _mm_cmpgt_epi16( v, del ) ),
+            _mm_or_si128( _mm_cmpeq_epi16( v, backslash ),
+            _mm_or_si128( _mm_cmpeq_epi16( v, open ), _mm_cmpeq_epi16( v, close ) ) ) );
+        if ( _mm_movemask_epi8( special ) != 0 )
+            break;
+        _mm_storel_epi64( (__m128i*)(out + i), _mm_packus_epi16( v, v ) );
+    }
+#endif
+
+    for ( ; i < size && !rtf_special( text[i] ); i++ )
+        out[i] = (char)text[i];
+
+    return i;
+}
+
+// Narrows leading run of plain UTF-32 code units into out, returns run length
+static size_t rtf_narrow_run(const char32_t* text, size_t size, char* out)
+{
+    size_t i = 0;
+
+#ifdef RTF_HAVE_SSE2
+    const __m128i space = _mm_set1_epi32( 0x20 );
+    const __m128i del = _mm_set1_epi32( 0x7f );
+    const __m128i backslash = _mm_set1_epi32( '\\' );
+    const __m128i open = _mm_set1_epi32( '{' );
+    const __m128i close = _mm_set1_epi32( '}' );
+    for ( ; i + 4 <= size; i += 4 )
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(text + i) );
+        __m128i special = _mm_or_si128( _mm_or_si128( _mm_cmplt_epi32( v, space ), _mm_cmpgt_epi32( v, del ) ),
+            _mm_or_si128( _mm_cmpeq_epi32( v, backslash ),
+            _mm_or_si128( _mm_cmpeq_epi32( v, open ), _mm_cmpeq_epi32( v, close ) ) ) );
+        if ( _mm_movemask_epi8( special ) != 0 )
+            break;
+
+        // All four units are ASCII, pack them down to bytes
+        __m128i w = _mm_packs_epi32( v, v );
+        int bytes = _mm_cvtsi128_si32( _mm_packus_epi16( w, w ) );
+        memcpy( out + i, &bytes, 4 );
+    }
+#endif
+
+    for ( ; i < size && !rtf_special( text[i] ); i++ )
+        out[i] = (char)text[i];
+
+    return i;
+}
+
+// Length of leading single-byte run without RTF specials
+static size_t rtf_ansi_run(const char* text, size_t size)
+{
+    size_t i = 0;
+
+#ifdef RTF_HAVE_SSE2
+    const __m128i backslash = _mm_set1_epi8( '\\' );
+    const __m128i open = _mm_set1_epi8( '{' );
+    const __m128i close = _mm_set1_epi8( '}' );
+    for ( ; i + 16 <= size; i += 16 )
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(text + i) );
+        __m128i special = _mm_or_si128( _mm_cmpeq_epi8( v, backslash ),
+            _mm_or_si128( _mm_cmpeq_epi8( v, open ), _mm_cmpeq_epi8( v, close ) ) );
+        unsigned mask = (unsigned)_mm_movemask_epi8( special );
+        if ( mask != 0 )
+            return i + rtf_ctz( mask );
+    }
+#endif
+
+    while ( i < size && text[i] != '\\' && text[i] != '{' && text[i] != '}' )
+        i++;
+
+    return i;
+}
+
+RtfSink::RtfSink(size_t bufferSize): _buffer(NULL), _size(0), _capacity(0), _bufferSize(bufferSize),
+    _flushPolicy(RTF_FLUSH_BUFFERFULL), _error(false), _closed(false)
+{
+    // Buffer is allocated by the first write, unless taken over from a previous sink
+}
+
+RtfSink::~RtfSink()
+{
+    // Derived sinks close themselves, the backend is gone at this point
+    delete[] _buffer;
+}
+
+
+// Appends data not fitting in the buffer
+bool RtfSink::write_slow(const char* data, size_t size)
+{
+    if ( _error || _closed )
+        return false;
+
+    // Make room in the buffer
+    if ( !drain() )
+        return false;
+
+    if ( _buffer == NULL && _bufferSize > 0 )
+    {
+        _buffer = new char[_bufferSize];
+        _capacity = _bufferSize;
+    }
+
+    // Large fragments go straight to the backend
+    if ( size >= _capacity - _size )
+    {
+        if ( size > 0 && !write_raw( data, size ) )
+            _error = true;
+        return !_error;
+    }
+
+    memcpy( _buffer + _size, data, size );
+    _size += size;
+    return true;
+}
+
+
+// Hands buffered data to the backend, which may keep a remainder buffered
+bool RtfSink::drain()
+{
+    size_t size = _size;
+    _size = 0;
+    if ( size > 0 && !_error )
+    {
+        if ( !write_raw( _buffer, size ) )
+            _error = true;
+    }
+
+    return !_error;
+}
+
+
+// Marks end of paragraph or table row
+bool RtfSink::end_block()
+{
+    if ( _flushPolicy == RTF_FLUSH_PARAGRAPH )
+        return drain();
+
+    return !_error;
+}
+
+
+// Writes buffered data to the backend
+bool RtfSink::flush()
+{
+    if ( drain() && !sync_raw() )
+        _error = true;
+
+    return !_error;
+}
+
+
+// Flushes and closes the backend
+bool RtfSink::close()
+{
+    if ( _closed )
+        return !_error;
+
+    flush();
+    if ( !close_raw() )
+        _error = true;
+    _closed = true;
+
+    return !_error;
+}
+
+
+// No write error occured so far
+bool RtfSink::good() const
+{
+    return !_error;
+}
+
+
+// Sets sink flush policy
+void RtfSink::set_flushpolicy(int policy)
+{
+    _flushPolicy = policy;
+}
+
+
+// Gets sink flush policy
+int RtfSink::get_flushpolicy() const
+{
+    return _flushPolicy;
+}
+
+
+// Commits backend buffers
+bool RtfSink::sync_raw()
+{
+    return true;
+}
+
+
+// Closes the backend
+bool RtfSink::close_raw()
+{
+    return true;
+}
+
+
+// Takes over the buffer of a closed sink before the first write, unless it is smaller than the buffer size
+void RtfSink::reuse_buffer(RtfSink& previous)
+{
+    if ( !previous._closed || _buffer != NULL || _bufferSize == 0 || previous._capacity < _bufferSize )
+        return;
+
+    std::swap( _buffer, previous._buffer );
+    std::swap( _capacity, previous._capacity );
+}
+
+
+#ifdef RTF_HAVE_AVX2
+// Encodes whole 32 byte blocks as lower case hex, returns number of encoded bytes
+RTF_TARGET("avx2") static size_t rtf_hex_blocks_avx2(const unsigned char* data, size_t size, char* out)
+{
+    const __m256i digits = _mm256_setr_epi8( '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' );
+    const __m256i nibble = _mm256_set1_epi8( 0x0f );
+    size_t i = 0;
+    for ( ; i + 32 <= size; i += 32 )
+    {
+        __m256i v = _mm256_loadu_si256( (const __m256i*)(data + i) );
+        __m256i hi = _mm256_shuffle_epi8( digits, _mm256_and_si256( _mm256_srli_epi16( v, 4 ), nibble ) );
+        __m256i lo = _mm256_shuffle_epi8( digits, _mm256_and_si256( v, nibble ) );
+
+        // Unpack works per 128-bit lane, put the lanes back in order
+        __m256i first = _mm256_unpacklo_epi8( hi, lo );
+        __m256i second = _mm256_unpackhi_epi8( hi, lo );
+        _mm256_storeu_si256( (__m256i*)(out + 2*i), _mm256_permute2x128_si256( first, second, 0x20 ) );
+        _mm256_storeu_si256( (__m256i*)(out + 2*i + 32), _mm256_permute2x128_si256( first, second, 0x31 ) );
+    }
+
+    return i;
+}
+#endif
+
+#ifdef RTF_HAVE_SSSE3
+// Encodes whole 16 byte blocks from i as lower case hex with pshufb nibble lookup, returns end of encoded bytes
+RTF_TARGET("ssse3") static size_t rtf_hex_blocks_ssse3(const unsigned char* data, size_t size, char* out, size_t i)
+{
+    const __m128i digits = _mm_setr_epi8( '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' );
+    const __m128i nibble = _mm_set1_epi8( 0x0f );
+    for ( ; i + 16 <= size; i += 16 )
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(data + i) );
+        __m128i hi = _mm_shuffle_epi8( digits, _mm_and_si128( _mm_srli_epi16( v, 4 ), nibble ) );
+        __m128i lo = _mm_shuffle_epi8( digits, _mm_and_si128( v, nibble ) );
+        _mm_storeu_si128( (__m128i*)(out + 2*i), _mm_unpacklo_epi8( hi, lo ) );
+        _mm_storeu_si128( (__m128i*)(out + 2*i + 16), _mm_unpackhi_epi8( hi, lo ) );
+    }
+
+    return i;
+}
+#endif
+
+
+// Encodes binary data as lower case hex, out receives 2*size characters
+void RtfSink::encode_hex(const unsigned char* data, size_t size, char* out)
+{
+    size_t i = 0;
+
+#ifdef RTF_HAVE_AVX2
+    if ( RTF_CPU_AVX2 )
+        i = rtf_hex_blocks_avx2( data, size, out );
+#endif
+
+#ifdef RTF_HAVE_SSSE3
+    if ( RTF_CPU_SSSE3 )
+        i = rtf_hex_blocks_ssse3( data, size, out, i );
+#endif
+
+#ifdef RTF_HAVE_SSE2
+    // Blocks left without SSSE3, nibble plus '0' plus the gap to 'a' for nibbles above 9
+    const __m128i nibble = _mm_set1_epi8( 0x0f );
+    const __m128i nine = _mm_set1_epi8( 9 );
+    const __m128i zero = _mm_set1_epi8( '0' );
+    const __m128i gap = _mm_set1_epi8( 'a' - '0' - 10 );
+    for ( ; i + 16 <= size; i += 16 )
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(data + i) );
+        __m128i hi = _mm_and_si128( _mm_srli_epi16( v, 4 ), nibble );
+        __m128i lo = _mm_and_si128( v, nibble );
+        hi = _mm_add_epi8( _mm_add_epi8( hi, zero ), _mm_and_si128( _mm_cmpgt_epi8( hi, nine ), gap ) );
+        lo = _mm_add_epi8( _mm_add_epi8( lo, zero ), _mm_and_si128( _mm_cmpgt_epi8( lo, nine ), gap ) );
+        _mm_storeu_si128( (__m128i*)(out + 2*i), _mm_unpacklo_epi8( hi, lo ) );
+        _mm_storeu_si128( (__m128i*)(out + 2*i + 16), _mm_unpackhi_epi8( hi, lo ) );
+    }
+#endif
+
+    for ( ; i < size; i++ )
+    {
+        out[2*i] = rtfHexDigits[data[i] >> 4];
+        out[2*i+1] = rtfHexDigits[data[i] & 0x0f];
+    }
+}
+
+
+// Appends binary data as hex lines, as used by embedded pictures
+bool RtfSink::write_hex(const unsigned char* data, size_t size)
+{
+    char line[RTF_HEXLINE_BYTES * 2 + 1];
+
+    while ( size > 0 && !_error )
+    {
+        size_t count = size < RTF_HEXLINE_BYTES ? size : RTF_HEXLINE_BYTES;
+        size_t length = count * 2 + 1;
+
+        // Encode straight into the sink buffer whenever a line fits
+        if ( length > _capacity - _size && length <= _capacity )
+            drain();
+        char* out = length <= _capacity - _size ? _buffer + _size : line;
+
+        encode_hex( data, count, out );
+        out[length - 1] = '\n';
+        if ( out == line )
+            write( line, length );
+        else
+            _size += length;
+
+        data += count;
+        size -= count;
+    }
+
+    return !_error;
+}
+
+
+// Appends 64-bit decimal number
+bool RtfSink::write_int64(int64_t value)
+{
+    char digits[24];
+    std::to_chars_result result = std::to_chars( digits, digits + sizeof(digits), value );
+    return write( digits, result.ptr - digits );
+}
+
+
+// Appends floating point number in shortest round-trip form
+bool RtfSink::write_double(double value)
+{
+    char digits[32];
+    std::to_chars_result result = std::to_chars( digits, digits + sizeof(digits), value );
+    return write( digits, result.ptr - digits );
+}
+
+
+// Appends \'hh escape
+void RtfSink::write_hexbyte(unsigned char c)
+{
+    char hex[4] = { '\\', '\'', rtfHexDigits[c >> 4], rtfHexDigits[c & 0x0f] };
+    write( hex, 4 );
+}
+
+
+// Appends escaped or encoded character
+void RtfSink::write_codepoint(unsigned long cp)
+{
+    switch (cp)
+    {
+        case '\\':
+            write( "\\\\" );
+            return;
+
+        case '{':
+            write( "\\{" );
+            return;
+
+        case '}':
+            write( "\\}" );
+            return;
+
+        case '\t':
+            write( "\\tab " );
+            return;
+
+        case '\n':
+            write( "\\line " );
+            return;
+
+        // Carriage returns carry no meaning in RTF text
+        case '\r':
+            return;
+    }
+
+    if ( cp < 0x20 )
+        write_hexbyte( (unsigned char)cp );
+    else if ( cp < 0x80 )
+        put( (char)cp );
+    else if ( cp <= 0xffff )
+    {
+        // \uN takes a signed 16-bit value, followed by the ANSI fallback
+        write( "\\u" );
+        write_int( (short)cp );
+        put( '?' );
+    }
+    else if ( cp <= 0x10ffff )
+    {
+        // Characters outside the BMP are written as a surrogate pair
+        cp -= 0x10000;
+        write_codepoint( 0xd800 + (cp >> 10) );
+        write_codepoint( 0xdc00 + (cp & 0x3ff) );
+    }
+    else
+        put( '?' );
+}
+
+
+// Appends single-byte text of the document code page, only RTF specials are escaped
+bool RtfSink::write_ansi(std::string_view text)
+{
+    const char* p = text.data();
+    size_t size = text.size();
+
+    while ( size > 0 )
+    {
+        size_t run = rtf_ansi_run( p, size );
+        write( p, run );
+        p += run;
+        size -= run;
+        if ( size == 0 )
+            break;
+
+        put( '\\' );
+        put( *p++ );
+        size--;
+    }
+
+    return !_error;
+}
+
+
+// Appends UTF-8 text escaped for RTF
+bool RtfSink::write_text(std::string_view text)
+{
+    const char* p = text.data();
+    size_t size = text.size();
+
+    while ( size > 0 )
+    {
+        // Copy plain ASCII in bulk
+        size_t run = rtf_plain_run( p, size );
+        write( p, run );
+        p += run;
+        size -= run;
+        if ( size == 0 )
+            break;
+
+        unsigned char c = (unsigned char)*p;
+        if ( c < 0x80 )
+        {
+            write_codepoint( c );
+            p++;
+            size--;
+            continue;
+        }
+
+        // Decode UTF-8 sequence
+        size_t length = 0;
+        unsigned long cp = 0;
+        if ( c >= 0xc2 && c <= 0xdf )
+        {
+            length = 2;
+            cp = c & 0x1f;
+        }
+        else if ( c >= 0xe0 && c <= 0xef )
+        {
+            length = 3;
+            cp = c & 0x0f;
+        }
+        else if ( c >= 0xf0 && c <= 0xf4 )
+        {
+            length = 4;
+            cp = c & 0x07;
+        }
+
+        bool valid = length > 0 && length <= size;
+        for ( size_t k = 1; valid && k < length; k++ )
+        {
+            unsigned char cc = (unsigned char)p[k];
+            if ( (cc & 0xc0) != 0x80 )
+                valid = false;
+            cp = (cp << 6) | (cc & 0x3f);
+        }
+        if ( valid && ( (length == 3 && cp < 0x800) || (length == 4 && (cp < 0x10000 || cp > 0x10ffff)) ||
+             (cp >= 0xd800 && cp <= 0xdfff) ) )
+            valid = false;
+
+        // Bytes which are not UTF-8 are passed on as code page characters
+        if ( !valid )
+        {
+            write_hexbyte( c );
+            p++;
+            size--;
+            continue;
+        }
+
+        write_codepoint( cp );
+        p += length;
+        size -= length;
+    }
+
+    return !_error;
+}
+
+
+// Appends UTF-16 text escaped for RTF
+bool RtfSink::write_text(std::u16string_view text)
+{
+    const char16_t* p = text.data();
+    size_t size = text.size();
+    char chunk[256];
+
+    while ( size > 0 )
+    {
+        // Copy plain ASCII in bulk
+        size_t run = rtf_narrow_run( p, size < sizeof(chunk) ? size : sizeof(chunk), chunk );
+        write( chunk, run );
+        p += run;
+        size -= run;
+
+        // Surrogates map one to one onto \uN values
+        if ( size > 0 && rtf_special( *p ) )
+        {
+            write_codepoint( *p );
+            p++;
+            size--;
+        }
+    }
+
+    return !_error;
+}
+
+
+// Appends UTF-32 text escaped for RTF
+bool RtfSink::write_text(std::u32string_view text)
+{
+    const char32_t* p = text.data();
+    size_t size = text.size();
+    char chunk[256];
+
+    while ( size > 0 )
+    {
+        // Copy plain ASCII in bulk
+        size_t run = rtf_narrow_run( p, size < sizeof(chunk) ? size : sizeof(chunk), chunk );
+        write( chunk, run );
+        p += run;
+        size -= run;
+
+        if ( size > 0 && rtf_special( *p ) )
+        {
+            write_codepoint( *p );
+            p++;
+            size--;
+        }
+    }
+
+    return !_error;
+}
+
+
+// Appends wide text escaped for RTF
+bool RtfSink::write_text(std::wstring_view text)
+{
+    // wchar_t is UTF-16 on Windows and UTF-32 elsewhere
+    if constexpr ( sizeof(wchar_t) == sizeof(char16_t) )
+        return write_text( std::u16string_view( (const char16_t*)text.data(), text.size() ) );
+    else
+        return write_text( std::u32string_view( (const char32_t*)text.data(), text.size() ) );
+}
+
+
+RtfFileSink::RtfFileSink(FILE* file, bool ownsFile, size_t bufferSize): RtfSink(bufferSize), _file(file), _ownsFile(ownsFile)
+{
+    // Sink or the async sink writing through it buffers, avoid copying everything twice
+    if ( _file != NULL && _ownsFile )
+        setvbuf( _file, NULL, _IONBF, 0 );
+}
+
+RtfFileSink::~RtfFileSink()
+{
+    close();
+}
+
+bool RtfFileSink::write_raw(const char* data, size_t size)
+{
+    return _file != NULL && fwrite( data, 1, size, _file ) == size;
+}
+
+bool RtfFileSink::sync_raw()
+{
+    return _file != NULL && fflush( _file ) == 0;
+}
+
+bool RtfFileSink::close_raw()
+{
+    bool result = true;
+    if ( _file != NULL && _ownsFile )
+        result = fclose( _file ) == 0;
+    _file = NULL;
+
+    return result;
+}
+
+
+RtfFdSink::RtfFdSink(int fd, bool ownsFd, size_t bufferSize): RtfSink(bufferSize), _fd(fd), _ownsFd(ownsFd)
+{
+
+}
+
+RtfFdSink::~RtfFdSink()
+{
+    close();
+}
+
+bool RtfFdSink::write_raw(const char* data, size_t size)
+{
+    // Write everything, retrying on short writes and signals
+    while ( size > 0 )
+    {
+#ifdef _WIN32
+        int chunk = size > 0x40000000 ? 0x40000000 : (int)size;
+        int written = _write( _fd, data, chunk );
+#else
+        ssize_t written = ::write( _fd, data, size );
+#endif
+        if ( written < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return false;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+bool RtfFdSink::close_raw()
+{
+    bool result = true;
+    if ( _fd >= 0 && _ownsFd )
+    {
+#ifdef _WIN32
+        result = _close( _fd ) == 0;
+#else
+        result = ::close( _fd ) == 0;
+#endif
+    }
+    _fd = -1;
+
+    return result;
+}
+
+
+RtfAsyncSink::RtfAsyncSink(std::unique_ptr<RtfSink> target, size_t bufferSize): RtfSink(bufferSize > 0 ? bufferSize : RTF_SINK_BUFFERSIZE),
+    _target(std::move(target)), _spare(NULL), _pending(0), _stop(false), _ioError(false)
+{
+    _spare = new char[_bufferSize];
+    if ( !_target )
+        _ioError = true;
+
+    _thread = std::thread( &RtfAsyncSink::run, this );
+}
+
+RtfAsyncSink::~RtfAsyncSink()
+{
+    close();
+    delete[] _spare;
+}
+
+
+// Buffers are owned by the I/O handoff and never exchanged
+void RtfAsyncSink::reuse_buffer(RtfSink&)
+{
+}
+
+
+bool RtfAsyncSink::write_raw(const char* data, size_t size)
+{
+    if ( !wait_idle() )
+        return false;
+
+    // Fragments passed around the buffer are written here, the I/O thread is idle
+    if ( data != _buffer )
+        return _target->write( data, size );
+
+    // Hand the filled buffer over and continue in the other one
+    {
+        std::lock_guard<std::mutex> lock( _mutex );
+        std::swap( _buffer, _spare );
+        _pending = size;
+    }
+    _ready.notify_one();
+
+    return true;
+}
+
+
+bool RtfAsyncSink::sync_raw()
+{
+    return wait_idle() && _target->flush();
+}
+
+
+bool RtfAsyncSink::close_raw()
+{
+    bool result = wait_idle();
+
+    // Stop the I/O thread before closing its target
+    {
+        std::lock_guard<std::mutex> lock( _mutex );
+        _stop = true;
+    }
+    _ready.notify_one();
+    if ( _thread.joinable() )
+        _thread.join();
+
+    if ( _target && !_target->close() )
+        result = false;
+
+    return result;
+}
+
+
+// Waits until the buffer in flight is written, returns false after an I/O error
+bool RtfAsyncSink::wait_idle()
+{
+    std::unique_lock<std::mutex> lock( _mutex );
+    _idle.wait( lock, [this] { return _pending == 0; } );
+
+    return !_ioError;
+}
+
+
+// Writes buffers handed over by the producer until stopped
+void RtfAsyncSink::run()
+{
+    std::unique_lock<std::mutex> lock( _mutex );
+    for ( ;; )
+    {
+        _ready.wait( lock, [this] { return _pending > 0 || _stop; } );
+        if ( _pending == 0 )
+            break;
+
+        // Producer does not touch the buffer in flight, write it unlocked
+        const char* data = _spare;
+        size_t size = _pending;
+        lock.unlock();
+        bool written = !_ioError && _target->write( data, size );
+        lock.lock();
+
+        if ( !written )
+            _ioError = true;
+        _pending = 0;
+        _idle.notify_all();
+    }
+}
+
+
+#ifndef _WIN32
+// Switches O_DIRECT of a file descriptor
+static bool rtf_set_direct(int fd, bool direct)
+{
+#ifdef O_DIRECT
+    int flags = fcntl( fd, F_GETFL );
+    if ( flags < 0 )
+        return false;
+
+    flags = direct ? ( flags | O_DIRECT ) : ( flags & ~O_DIRECT );
+    return fcntl( fd, F_SETFL, flags ) == 0;
+#else
+    return false;
+#endif
+}
+
+
+RtfPosixSink::RtfPosixSink(int fd, bool ownsFd, int options, uint64_t sizeHint, size_t bufferSize): RtfFdSink(fd, ownsFd, bufferSize),
+    _options(options), _start(0), _written(0), _reserved(0), _dropped(0), _direct(false)
+{
+    // Offsets are only known for regular files
+    _start = lseek( _fd, 0, SEEK_CUR );
+    if ( _start < 0 )
+    {
+        _options = 0;
+        return;
+    }
+
+#ifdef RTF_HAVE_FADVISE
+    // Reserve blocks up front, the file is truncated to the written size on close
+    if ( sizeHint > 0 && posix_fallocate( _fd, _start, sizeHint ) == 0 )
+        _reserved = sizeHint;
+#endif
+
+    // O_DIRECT needs aligned offsets and buffers, the file system may not support it.
+    // The sink buffer itself is the aligned block, whole blocks are written from it
+    if ( _options & RTF_FILEOPTION_DIRECT )
+    {
+        size_t capacity = ( bufferSize + RTF_DIRECT_ALIGNMENT - 1 ) & ~(size_t)( RTF_DIRECT_ALIGNMENT - 1 );
+        void* block = NULL;
+        if ( capacity == 0 )
+            capacity = RTF_DIRECT_ALIGNMENT;
+        if ( _start % RTF_DIRECT_ALIGNMENT == 0 && posix_memalign( &block, RTF_DIRECT_ALIGNMENT, capacity ) == 0 )
+        {
+            if ( rtf_set_direct( _fd, true ) )
+            {
+                _buffer = (char*)block;
+                _capacity = capacity;
+                _direct = true;
+            }
+            else
+                free( block );
+        }
+
+        if ( !_direct )
+            _options &= ~RTF_FILEOPTION_DIRECT;
+    }
+}
+
+RtfPosixSink::~RtfPosixSink()
+{
+    close();
+}
+
+
+// Creates file sink, returns NULL if the file could not be created
+std::unique_ptr<RtfPosixSink> RtfPosixSink::create(const char* path, int options, uint64_t sizeHint, size_t bufferSize)
+{
+    int fd = ::open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+    if ( fd < 0 )
+        return std::unique_ptr<RtfPosixSink>();
+
+    return std::unique_ptr<RtfPosixSink>( new RtfPosixSink(fd, true, options, sizeHint, bufferSize) );
+}
+
+
+// Gets options in effect, unsupported options are cleared
+int RtfPosixSink::get_options() const
+{
+    return _options;
+}
+
+
+bool RtfPosixSink::write_raw(const char* data, size_t size)
+{
+    if ( !_direct )
+    {
+        if ( !RtfFdSink::write_raw( data, size ) )
+            return false;
+        _written += size;
+    }
+    else if ( data == _buffer )
+    {
+        // Whole blocks go to the file straight from the buffer, the remainder stays buffered
+        size_t blocks = size & ~(size_t)( RTF_DIRECT_ALIGNMENT - 1 );
+        if ( !write_blocks( _buffer, blocks ) )
+            return false;
+        _size = size - blocks;
+        if ( _size > 0 )
+            memmove( _buffer, _buffer + blocks, _size );
+    }
+    else
+    {
+        // Fragments passed around the buffer are not aligned, they are written through it
+        while ( size > 0 )
+        {
+            size_t chunk = _capacity - _size;
+            if ( chunk > size )
+                chunk = size;
+            memcpy( _buffer + _size, data, chunk );
+            _size += chunk;
+            data += chunk;
+            size -= chunk;
+
+            if ( _size == _capacity )
+            {
+                if ( !write_blocks( _buffer, _capacity ) )
+                    return false;
+                _size = 0;
+            }
+        }
+    }
+
+    // Keep only the last window of written pages cached
+    if ( ( _options & RTF_FILEOPTION_DROPCACHE ) && _written >= _dropped + 2 * (uint64_t)RTF_DROPCACHE_WINDOW )
+        drop_cache( false );
+
+    return true;
+}
+
+
+// Drops written pages, a remainder of O_DIRECT output smaller than a block stays buffered until close
+bool RtfPosixSink::sync_raw()
+{
+    if ( _options & RTF_FILEOPTION_DROPCACHE )
+        drop_cache( true );
+
+    return true;
+}
+
+
+bool RtfPosixSink::close_raw()
+{
+    bool result = true;
+    if ( _fd >= 0 )
+    {
+        // Remainder is not block sized, it is written through the page cache
+        if ( _direct )
+        {
+            if ( _size > 0 && ( !rtf_set_direct( _fd, false ) || !RtfFdSink::write_raw( _buffer, _size ) ) )
+                result = false;
+            _written += _size;
+            _size = 0;
+        }
+
+        // Release blocks preallocated beyond the end of the document
+        if ( _reserved > _written && ftruncate( _fd, _start + _written ) != 0 )
+            result = false;
+
+        if ( _options & RTF_FILEOPTION_DROPCACHE )
+            drop_cache( true );
+    }
+
+    if ( !RtfFdSink::close_raw() )
+        result = false;
+
+    // Aligned buffer is released with the file, it is never handed to another sink
+    if ( _direct )
+    {
+        free( _buffer );
+        _buffer = NULL;
+        _capacity = 0;
+        _direct = false;
+    }
+
+    return result;
+}
+
+
+// Writes whole O_DIRECT blocks from the aligned buffer
+bool RtfPosixSink::write_blocks(const char* data, size_t size)
+{
+    if ( size == 0 )
+        return true;
+    if ( !RtfFdSink::write_raw( data, size ) )
+        return false;
+
+    _written += size;
+    return true;
+}
+
+
+// Writes back and drops written pages from the page cache. Unless all pages are
+// dropped, the last window is only scheduled for writeback and stays cached. Only
+// Linux drops pages while writing, elsewhere they are dropped on flush and close.
+void RtfPosixSink::drop_cache(bool all)
+{
+#ifdef RTF_HAVE_FADVISE
+    uint64_t end = all ? _written : _written - RTF_DROPCACHE_WINDOW;
+    if ( end <= _dropped )
+        return;
+
+#ifdef __linux__
+    // Dirty pages can not be dropped, wait for their writeback first
+    sync_file_range( _fd, _start + _dropped, _written - _dropped, SYNC_FILE_RANGE_WRITE );
+    sync_file_range( _fd, _start + _dropped, end - _dropped, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+#else
+    // Without range writeback, pages are dropped only after writing back the whole file
+    if ( !all )
+        return;
+    fdatasync( _fd );
+#endif
+    posix_fadvise( _fd, _start + _dropped, end - _dropped, POSIX_FADV_DONTNEED );
+    _dropped = end;
+#else
+    (void)all;
+#endif
+}
+
+
+RtfMmapSink::RtfMmapSink(int fd, bool ownsFd, size_t growStep): RtfSink(0), _fd(fd), _ownsFd(ownsFd),
+    _map(NULL), _mapSize(0), _committed(0), _growStep(growStep > 0 ? growStep : RTF_MMAP_GROWSTEP)
+{
+    // Output starts at the beginning of the file
+    if ( _fd < 0 || !reserve( _growStep ) )
+        _error = true;
+}
+
+RtfMmapSink::~RtfMmapSink()
+{
+    close();
+}
+
+
+// Creates file sink, returns NULL if the file could not be created
+std::unique_ptr<RtfMmapSink> RtfMmapSink::create(const char* path, size_t growStep)
+{
+    // Shared writable mappings need read access
+    int fd = ::open( path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+    if ( fd < 0 )
+        return std::unique_ptr<RtfMmapSink>();
+
+    return std::unique_ptr<RtfMmapSink>( new RtfMmapSink(fd, true, growStep) );
+}
+
+
+// Mapping is owned by the sink and never exchanged
+void RtfMmapSink::reuse_buffer(RtfSink&)
+{
+}
+
+
+bool RtfMmapSink::write_raw(const char* data, size_t size)
+{
+    if ( _map == NULL )
+        return false;
+
+    // Buffered data is already in place, large fragments are copied
+    if ( data != _buffer )
+    {
+        if ( !reserve( size ) )
+            return false;
+        memcpy( _map + _committed, data, size );
+    }
+    _committed += size;
+
+    // Buffer runs short when the sink drains, grow it by a whole step
+    if ( _mapSize - _committed < _growStep / 2 && !reserve( _growStep ) )
+        return false;
+
+    _buffer = _map + _committed;
+    _capacity = _mapSize - _committed;
+    return true;
+}
+
+
+bool RtfMmapSink::close_raw()
+{
+    bool result = true;
+    if ( _map != NULL && munmap( _map, _mapSize ) != 0 )
+        result = false;
+    _map = NULL;
+    _buffer = NULL;
+    _capacity = 0;
+
+    // Drop unused part of the last growth step
+    if ( _fd >= 0 )
+    {
+        if ( ftruncate( _fd, _committed ) != 0 )
+            result = false;
+        if ( _ownsFd && ::close( _fd ) != 0 )
+            result = false;
+    }
+    _fd = -1;
+
+    return result;
+}
+
+
+// Grows the file and the mapping to hold size more bytes after the committed data
+bool RtfMmapSink::reserve(size_t size)
+{
+    if ( _mapSize - _committed >= size )
+        return true;
+
+    size_t mapSize = _mapSize + _growStep;
+    if ( mapSize < _committed + size )
+        mapSize = _committed + size;
+
+    // Allocating blocks reports a full disk here instead of SIGBUS on first touch,
+    // only file systems without preallocation are extended sparse
+#ifdef RTF_HAVE_FADVISE
+    int error = posix_fallocate( _fd, _mapSize, mapSize - _mapSize );
+    if ( error == EOPNOTSUPP || error == EINVAL )
+        error = ftruncate( _fd, mapSize );
+    if ( error != 0 )
+    {
+        _error = true;
+        return false;
+    }
+#else
+    if ( ftruncate( _fd, mapSize ) != 0 )
+        return false;
+#endif
+
+    void* map;
+    if ( _map == NULL )
+        map = mmap( NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0 );
+    else
+    {
+#ifdef __linux__
+        map = mremap( _map, _mapSize, mapSize, MREMAP_MAYMOVE );
+#else
+        // Written data is in the file, the old mapping can go first
+        munmap( _map, _mapSize );
+        _map = NULL;
+        _mapSize = 0;
+        map = mmap( NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0 );
+#endif
+    }
+    if ( map == MAP_FAILED )
+    {
+        if ( _map == NULL )
+        {
+            _buffer = NULL;
+            _capacity = 0;
+        }
+        return false;
+    }
+
+    _map = (char*)map;
+    _mapSize = mapSize;
+    _buffer = _map + _committed;
+    _capacity = _mapSize - _committed;
+    return true;
+}
+#endif
+
+
+#ifdef __linux__
+#ifdef RTF_HAVE_URING
+static int rtf_uring_setup(unsigned entries, io_uring_params* params)
+{
+    return (int)syscall( __NR_io_uring_setup, entries, params );
+}
+
+static int rtf_uring_enter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall( __NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0 );
+}
+
+static int rtf_uring_register(int ringFd, unsigned opcode, const void* arg, unsigned count)
+{
+    return (int)syscall( __NR_io_uring_register, ringFd, opcode, arg, count );
+}
+#endif
+
+
+RtfUringSink::RtfUringSink(int fd, size_t bufferSize): RtfSink(0), _fd(fd), _ownsFd(false), _offset(0), _block(NULL),
+    _slotSize(bufferSize > 0 ? bufferSize : RTF_SINK_BUFFERSIZE), _current(0), _ioError(false), _ringFd(-1), _queued(0),
+    _sqRing(NULL), _sqRingSize(0), _cqRing(NULL), _cqRingSize(0), _sqes(NULL), _sqesSize(0),
+    _sqTail(NULL), _sqMask(NULL), _sqArray(NULL), _cqHead(NULL), _cqTail(NULL), _cqMask(NULL), _cqes(NULL)
+{
+    // Buffers are page aligned for pinning
+    _slotSize = ( _slotSize + RTF_DIRECT_ALIGNMENT - 1 ) & ~(size_t)( RTF_DIRECT_ALIGNMENT - 1 );
+    memset( _writes, 0, sizeof(_writes) );
+}
+
+RtfUringSink::~RtfUringSink()
+{
+    close();
+    release();
+}
+
+
+// Creates file sink, returns NULL if the file could not be created
+std::unique_ptr<RtfSink> RtfUringSink::create(const char* path, size_t bufferSize)
+{
+    int fd = ::open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+    if ( fd < 0 )
+        return std::unique_ptr<RtfSink>();
+
+    return create( fd, true, bufferSize );
+}
+
+
+// Creates io_uring sink writing from the current file position, without io_uring
+// support in the kernel or for the file an RtfFdSink is created instead
+std::unique_ptr<RtfSink> RtfUringSink::create(int fd, bool ownsFd, size_t bufferSize)
+{
+    if ( fd < 0 )
+        return std::unique_ptr<RtfSink>();
+
+    std::unique_ptr<RtfUringSink> sink( new RtfUringSink(fd, bufferSize) );
+    if ( sink->setup() )
+    {
+        sink->_ownsFd = ownsFd;
+        return sink;
+    }
+    sink->release();
+    sink.reset();
+
+    return std::unique_ptr<RtfSink>( new RtfFdSink(fd, ownsFd, bufferSize) );
+}
+
+
+// Registered buffers are owned by the ring and never exchanged
+void RtfUringSink::reuse_buffer(RtfSink&)
+{
+}
+
+
+bool RtfUringSink::write_raw(const char* data, size_t size)
+{
+    // Buffered data is in the current registered buffer
+    if ( data == _buffer )
+        return submit( size );
+
+    // Large fragments are copied through the registered buffers
+    while ( size > 0 )
+    {
+        size_t chunk = size < _slotSize ? size : _slotSize;
+        memcpy( _buffer, data, chunk );
+        if ( !submit( chunk ) )
+            return false;
+        data += chunk;
+        size -= chunk;
+    }
+
+    return true;
+}
+
+
+// Waits for all writes, a descriptor of the caller is positioned after the written data
+bool RtfUringSink::sync_raw()
+{
+    bool result = !_ioError;
+    if ( _ringFd >= 0 )
+    {
+        for ( int i=0; i<RTF_URING_BUFFERS; i++ )
+        {
+            if ( !wait_write( i ) )
+                result = false;
+        }
+
+        // Writes go to explicit offsets and leave the file position alone
+        if ( !_ownsFd && lseek( _fd, _offset, SEEK_SET ) < 0 )
+            result = false;
+    }
+
+    return result;
+}
+
+
+bool RtfUringSink::close_raw()
+{
+    bool result = sync_raw();
+    release();
+
+    if ( _fd >= 0 && _ownsFd && ::close( _fd ) != 0 )
+        result = false;
+    _fd = -1;
+
+    return result;
+}
+
+
+// Creates the ring and registers the buffers
+bool RtfUringSink::setup()
+{
+#ifdef RTF_HAVE_URING
+    // Writes go to explicit offsets, pipes and sockets are left to write()
+    off_t start = lseek( _fd, 0, SEEK_CUR );
+    if ( start < 0 )
+        return false;
+    _offset = start;
+
+    io_uring_params params;
+    memset( &params, 0, sizeof(params) );
+    _ringFd = rtf_uring_setup( RTF_URING_BUFFERS, &params );
+    if ( _ringFd < 0 )
+        return false;
+
+    // Map submission and completion rings, recent kernels share one mapping
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if ( params.features & IORING_FEAT_SINGLE_MMAP )
+    {
+        if ( _cqRingSize > _sqRingSize )
+            _sqRingSize = _cqRingSize;
+        _cqRingSize = 0;
+    }
+
+    void* ring = mmap( NULL, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING );
+    if ( ring == MAP_FAILED )
+        return false;
+    _sqRing = ring;
+
+    if ( _cqRingSize > 0 )
+    {
+        ring = mmap( NULL, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING );
+        if ( ring == MAP_FAILED )
+            return false;
+        _cqRing = ring;
+    }
+    else
+        _cqRing = _sqRing;
+
+    _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    ring = mmap( NULL, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES );
+    if ( ring == MAP_FAILED )
+        return false;
+    _sqes = (io_uring_sqe*)ring;
+
+    char* sq = (char*)_sqRing;
+    char* cq = (char*)_cqRing;
+    _sqTail = (unsigned*)( sq + params.sq_off.tail );
+    _sqMask = (unsigned*)( sq + params.sq_off.ring_mask );
+    _sqArray = (unsigned*)( sq + params.sq_off.array );
+    _cqHead = (unsigned*)( cq + params.cq_off.head );
+    _cqTail = (unsigned*)( cq + params.cq_off.tail );
+    _cqMask = (unsigned*)( cq + params.cq_off.ring_mask );
+    _cqes = (io_uring_cqe*)( cq + params.cq_off.cqes );
+
+    // Register buffers once, fixed buffer writes skip pinning per request
+    void* block = NULL;
+    if ( posix_memalign( &block, RTF_DIRECT_ALIGNMENT, _slotSize * RTF_URING_BUFFERS ) != 0 )
+        return false;
+    _block = (char*)block;
+
+    iovec buffers[RTF_URING_BUFFERS];
+    for ( int i=0; i<RTF_URING_BUFFERS; i++ )
+    {
+        buffers[i].iov_base = _block + i * _slotSize;
+        buffers[i].iov_len = _slotSize;
+    }
+    if ( rtf_uring_register( _ringFd, IORING_REGISTER_BUFFERS, buffers, RTF_URING_BUFFERS ) != 0 )
+        return false;
+
+    _current = 0;
+    _buffer = _block;
+    _capacity = _slotSize;
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+// Submits current buffer and continues in the next one once its previous write completed
+bool RtfUringSink::submit(size_t size)
+{
+    RtfUringWrite& write = _writes[_current];
+    write.offset = _offset;
+    write.size = size;
+    write.done = 0;
+    write.busy = true;
+    _offset += size;
+
+    queue_write( _current );
+    if ( !enter( 0 ) )
+        return false;
+
+    _current = ( _current + 1 ) % RTF_URING_BUFFERS;
+    if ( !wait_write( _current ) )
+        return false;
+
+    _buffer = _block + _current * _slotSize;
+    return true;
+}
+
+
+// Queues fixed buffer write of the unwritten part of a buffer
+void RtfUringSink::queue_write(int index)
+{
+#ifdef RTF_HAVE_URING
+    const RtfUringWrite& write = _writes[index];
+    unsigned tail = *_sqTail;
+    unsigned slot = tail & *_sqMask;
+
+    io_uring_sqe* sqe = &_sqes[slot];
+    memset( sqe, 0, sizeof(io_uring_sqe) );
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = _fd;
+    sqe->addr = (uint64_t)(uintptr_t)( _block + index * _slotSize + write.done );
+    sqe->len = (unsigned)( write.size - write.done );
+    sqe->off = write.offset + write.done;
+    sqe->buf_index = (uint16_t)index;
+    sqe->user_data = (uint64_t)index;
+
+    _sqArray[slot] = slot;
+    __atomic_store_n( _sqTail, tail + 1, __ATOMIC_RELEASE );
+    _queued++;
+#else
+    (void)index;
+#endif
+}
+
+
+// Submits queued writes and waits for at least minComplete completions
+bool RtfUringSink::enter(unsigned minComplete)
+{
+#ifdef RTF_HAVE_URING
+    if ( _queued == 0 && minComplete == 0 )
+        return true;
+
+    int result;
+    do
+        result = rtf_uring_enter( _ringFd, _queued, minComplete, minComplete > 0 ? IORING_ENTER_GETEVENTS : 0 );
+    while ( result < 0 && errno == EINTR );
+
+    if ( result < 0 )
+    {
+        _ioError = true;
+        return false;
+    }
+
+    _queued -= (unsigned)result;
+    return true;
+#else
+    (void)minComplete;
+    return false;
+#endif
+}
+
+
+// Handles all available completions, short writes are continued
+void RtfUringSink::reap()
+{
+#ifdef RTF_HAVE_URING
+    unsigned head = *_cqHead;
+    unsigned tail = __atomic_load_n( _cqTail, __ATOMIC_ACQUIRE );
+    for ( ; head != tail; head++ )
+    {
+        const io_uring_cqe& cqe = _cqes[head & *_cqMask];
+        int index = (int)cqe.user_data;
+        RtfUringWrite& write = _writes[index];
+
+        if ( cqe.res > 0 )
+            write.done += cqe.res;
+        else if ( cqe.res != -EINTR && cqe.res != -EAGAIN )
+            _ioError = true;
+
+        if ( !_ioError && write.done < write.size )
+            queue_write( index );
+        else
+            write.busy = false;
+    }
+    __atomic_store_n( _cqHead, head, __ATOMIC_RELEASE );
+#endif
+}
+
+
+// Waits until the write of a buffer completed, returns false after a write error
+bool RtfUringSink::wait_write(int index)
+{
+    reap();
+    while ( _writes[index].busy )
+    {
+        if ( !enter( 1 ) )
+            return false;
+        reap();
+    }
+
+    return !_ioError;
+}
+
+
+// Unmaps and closes the ring, pending writes are cancelled
+void RtfUringSink::release()
+{
+    if ( _sqes != NULL )
+        munmap( _sqes, _sqesSize );
+    if ( _cqRing != NULL && _cqRing != _sqRing )
+        munmap( _cqRing, _cqRingSize );
+    if ( _sqRing != NULL )
+        munmap( _sqRing, _sqRingSize );
+    if ( _ringFd >= 0 )
+        ::close( _ringFd );
+    free( _block );
+
+    _sqes = NULL;
+    _cqRing = NULL;
+    _sqRing = NULL;
+    _ringFd = -1;
+    _block = NULL;
+    _buffer = NULL;
+    _capacity = 0;
+}
+#endif
@@ -0,0 +1,373 @@
+#pragma once
+/*
+Copyright (c) <year> <copyright holders>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "rtfdefs.h"
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+//
+// Buffered RTF output sink. Emitters append small fragments to a user-space
+// buffer which is handed to the backend in large blocks.
+class RtfSink
+{
+    public:
+        RtfSink(size_t bufferSize = RTF_SINK_BUFFERSIZE);
+        virtual ~RtfSink();
+
+        bool write(const char* data, size_t size);							// Appends data to the sink
+        bool write(std::string_view text);									// Appends text to the sink
+        bool put(char c);													// Appends single character to the sink
+        bool write_int(int value);											// Appends decimal number to the sink
+        template<size_t N>
+        bool emit(const char (&word)[N], int value);						// Appends control word with numeric parameter
+        bool write_int64(int64_t value);									// Appends 64-bit decimal number to the sink
+        bool write_double(double value);									// Appends floating point number to the sink
+        bool write_ansi(std::string_view text);								// Appends code page text with RTF specials escaped
+        bool write_text(std::string_view text);								// Appends UTF-8 text escaped for RTF
+        bool write_text(std::u16string_view text);							// Appends UTF-16 text escaped for RTF
+        bool write_text(std::u32string_view text);							// Appends UTF-32 text escaped for RTF
+        bool write_text(std::wstring_view text);							// Appends wide text escaped for RTF
+        bool write_hex(const unsigned char* data, size_t size);				// Appends binary data as hex lines
+        bool end_block();													// Marks end of paragraph or table row
+        bool flush();														// Writes buffered data to the backend
+        bool close();														// Flushes and closes the backend
+        bool good() const;													// No write error occured so far
+        void set_flushpolicy(int policy);									// Sets sink flush policy
+        int get_flushpolicy() const;										// Gets sink flush policy
+        virtual void reuse_buffer(RtfSink& previous);						// Takes over buffer of closed sink
+
+        static void encode_hex(const unsigned char* data, size_t size, char* out);	// Encodes binary data as hex
+
+    protected:
+        virtual bool write_raw(const char* data, size_t size) = 0;			// Writes data to the backend
+        virtual bool sync_raw();											// Commits backend buffers
+        virtual bool close_raw();											// Closes the backend
+
+        bool drain();														// Hands buffered data to the backend
+        bool write_slow(const char* data, size_t size);						// Appends data not fitting in the buffer
+        void write_codepoint(unsigned long cp);								// Appends escaped or encoded character
+        void write_hexbyte(unsigned char c);								// Appends \'hh escape
+
+        char*               _buffer;
+        size_t              _size;
+        size_t              _capacity;
+        size_t              _bufferSize;					// Size of buffer allocated by first write
+        int                 _flushPolicy;
+        bool                _error;
+        bool                _closed;
+
+    private:
+        RtfSink(const RtfSink&);
+        RtfSink& operator=(const RtfSink&);
+};
+
+inline bool RtfSink::write(const char* data, size_t size)
+{
+    // Fast path, fragment fits into the buffer
+    if ( size <= _capacity - _size )
+    {
+        if ( size > 0 )
+            memcpy( _buffer + _size, data, size );
+        _size += size;
+        return !_error;
+    }
+
+    return write_slow(data, size);
+}
+
+inline bool RtfSink::write(std::string_view text)
+{
+    return write(text.data(), text.size());
+}
+
+inline bool RtfSink::put(char c)
+{
+    if ( _size < _capacity )
+    {
+        _buffer[_size++] = c;
+        return !_error;
+    }
+
+    return write_slow(&c, 1);
+}
+
+inline bool RtfSink::write_int(int value)
+{
+    // Locale independent, no format string parsing
+    char digits[16];
+    std::to_chars_result result = std::to_chars( digits, digits + sizeof(digits), value );
+    return write( digits, result.ptr - digits );
+}
+
+template<size_t N>
+inline bool RtfSink::emit(const char (&word)[N], int value)
+{
+    // Fast path, control word and number are formatted in place
+    if ( N - 1 + 11 <= _capacity - _size )
+    {
+        memcpy( _buffer + _size, word, N - 1 );
+        std::to_chars_result result = std::to_chars( _buffer + _size + N - 1, _buffer + _capacity, value );
+        _size = result.ptr - _buffer;
+        return !_error;
+    }
+
+    write( word, N - 1 );
+    return write_int( value );
+}
+
+
+//
+// Sink writing to a stdio stream, an owned stream is switched to unbuffered
+class RtfFileSink : public RtfSink
+{
+    public:
+        RtfFileSink(FILE* file, bool ownsFile = true, size_t bufferSize = RTF_SINK_BUFFERSIZE);
+        ~RtfFileSink();
+
+    protected:
+        bool write_raw(const char* data, size_t size);
+        bool sync_raw();
+        bool close_raw();
+
+    private:
+        FILE*               _file;
+        bool                _ownsFile;
+};
+
+
+//
+// Sink writing to a file descriptor
+class RtfFdSink : public RtfSink
+{
+    public:
+        RtfFdSink(int fd, bool ownsFd = true, size_t bufferSize = RTF_SINK_BUFFERSIZE);
+        ~RtfFdSink();
+
+    protected:
+        bool write_raw(const char* data, size_t size);
+        bool close_raw();
+
+        int                 _fd;
+        bool                _ownsFd;
+};
+
+
+//
+// Sink handing filled buffers to a background I/O thread which writes them to
+// the target sink while the producer fills the other buffer. At most one buffer
+// is in flight, a producer running ahead of the I/O waits for it. Errors of
+// the target are reported by the next drain, flush or close.
+class RtfAsyncSink : public RtfSink
+{
+    public:
+        RtfAsyncSink(std::unique_ptr<RtfSink> target, size_t bufferSize = RTF_SINK_BUFFERSIZE);
+        ~RtfAsyncSink();
+
+        void reuse_buffer(RtfSink& previous);								// Buffers are owned by the I/O handoff
+
+    protected:
+        bool write_raw(const char* data, size_t size);
+        bool sync_raw();
+        bool close_raw();
+
+    private:
+        bool wait_idle();													// Waits for the buffer in flight, false after I/O error
+        void run();															// I/O thread loop
+
+        std::unique_ptr<RtfSink> _target;					// Sink written by the I/O thread
+        char*               _spare;							// Buffer in flight or ready for the next swap
+        size_t              _pending;						// Bytes of the buffer in flight, 0 when idle
+        bool                _stop;							// I/O thread is asked to exit
+        bool                _ioError;						// Target failed to write
+        std::mutex          _mutex;
+        std::condition_variable _ready;						// Buffer handed over or stop requested
+        std::condition_variable _idle;						// Buffer in flight was written
+        std::thread         _thread;						// I/O thread
+};
+
+
+#ifndef _WIN32
+//
+// Sink writing to a POSIX file with optional preallocation, page cache
+// dropping and O_DIRECT output. O_DIRECT output is written in whole blocks from
+// the aligned sink buffer, the remainder not filling a whole block is written
+// without O_DIRECT on close.
+class RtfPosixSink : public RtfFdSink
+{
+    public:
+        RtfPosixSink(int fd, bool ownsFd = true, int options = 0, uint64_t sizeHint = 0, size_t bufferSize = RTF_SINK_BUFFERSIZE);
+        ~RtfPosixSink();
+
+        static std::unique_ptr<RtfPosixSink> create(const char* path, int options = 0, uint64_t sizeHint = 0, size_t bufferSize = RTF_SINK_BUFFERSIZE);	// Creates file sink, NULL on error
+        int get_options() const;											// Gets options in effect (RTF_FILEOPTION_*)
+
+    protected:
+        bool write_raw(const char* data, size_t size);
+        bool sync_raw();
+        bool close_raw();
+
+    private:
+        bool write_blocks(const char* data, size_t size);					// Writes whole O_DIRECT blocks
+        void drop_cache(bool all);											// Writes back and drops written pages
+
+        int                 _options;						// Options in effect (RTF_FILEOPTION_*)
+        int64_t             _start;							// File offset of the first written byte
+        uint64_t            _written;						// Bytes written to the file
+        uint64_t            _reserved;						// Bytes preallocated from the size hint
+        uint64_t            _dropped;						// Bytes dropped from the page cache
+        bool                _direct;						// O_DIRECT output from the aligned sink buffer
+};
+
+
+//
+// Sink writing into a shared file mapping. The mapping is the sink buffer, so
+// output is neither copied nor passed to write(). The file grows in large steps
+// and is truncated to the written size on close.
+class RtfMmapSink : public RtfSink
+{
+    public:
+        RtfMmapSink(int fd, bool ownsFd = true, size_t growStep = RTF_MMAP_GROWSTEP);
+        ~RtfMmapSink();
+
+        static std::unique_ptr<RtfMmapSink> create(const char* path, size_t growStep = RTF_MMAP_GROWSTEP);	// Creates file sink, NULL on error
+        void reuse_buffer(RtfSink& previous);								// Mapping is never exchanged
+
+    protected:
+        bool write_raw(const char* data, size_t size);
+        bool close_raw();
+
+    private:
+        bool reserve(size_t size);											// Grows the mapping to hold size more bytes
+
+        int                 _fd;
+        bool                _ownsFd;
+        char*               _map;							// File mapping
+        size_t              _mapSize;						// Size of the mapping and the file
+        size_t              _committed;						// Bytes written to the mapping
+        size_t              _growStep;						// Mapping growth step
+};
+#endif
+
+
+#ifdef __linux__
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+//
+// Sink submitting writes through io_uring. Output is formatted into one of
+// several registered buffers, a filled buffer is submitted as a fixed buffer
+// write at the next file offset and formatting continues in the next buffer.
+// Completions are reaped in batches when a buffer is needed again. Not offered
+// as a writer file backend, bench/sink_bench.cpp shows no gain over RtfFdSink.
+class RtfUringSink : public RtfSink
+{
+    public:
+        ~RtfUringSink();
+
+        static std::unique_ptr<RtfSink> create(const char* path, size_t bufferSize = RTF_SINK_BUFFERSIZE);	// Creates file sink, NULL on error
+        static std::unique_ptr<RtfSink> create(int fd, bool ownsFd = true, size_t bufferSize = RTF_SINK_BUFFERSIZE);	// Falls back to RtfFdSink without io_uring
+        void reuse_buffer(RtfSink& previous);								// Registered buffers are never exchanged
+
+    protected:
+        bool write_raw(const char* data, size_t size);
+        bool sync_raw();
+        bool close_raw();
+
+    private:
+        struct RtfUringWrite
+        {
+            uint64_t            offset;						// File offset of the buffer
+            size_t              size;						// Bytes to write
+            size_t              done;						// Bytes written so far
+            bool                busy;						// Write is in flight
+        };
+
+        RtfUringSink(int fd, size_t bufferSize);
+
+        bool setup();														// Creates the ring and registers the buffers
+        bool submit(size_t size);											// Submits current buffer, continues in the next one
+        void queue_write(int index);										// Queues write of the unwritten part of a buffer
+        bool enter(unsigned minComplete);									// Submits queued writes, waits for completions
+        void reap();														// Handles all available completions
+        bool wait_write(int index);											// Waits until buffer is written, false on error
+        void release();														// Unmaps and closes the ring
+
+        int                 _fd;
+        bool                _ownsFd;
+        uint64_t            _offset;						// File offset of the next write
+        char*               _block;							// Registered buffers
+        size_t              _slotSize;						// Size of one registered buffer
+        int                 _current;						// Buffer being filled
+        RtfUringWrite       _writes[RTF_URING_BUFFERS];		// Write state of each buffer
+        bool                _ioError;						// Write failed
+        int                 _ringFd;
+        unsigned            _queued;						// Queued writes not yet submitted
+        void*               _sqRing;
+        size_t              _sqRingSize;
+        void*               _cqRing;
+        size_t              _cqRingSize;
+        io_uring_sqe*       _sqes;
+        size_t              _sqesSize;
+        unsigned*           _sqTail;
+        unsigned*           _sqMask;
+        unsigned*           _sqArray;
+        unsigned*           _cqHead;
+        unsigned*           _cqTail;
+        unsigned*           _cqMask;
+        io_uring_cqe*       _cqes;
+};
+#endif
+
+
+//
+// Sink appending to an in-memory container (std::string or std::vector<char>).
+// The container is the buffer, so no intermediate buffer is used.
+template<class Container>
+class RtfMemorySink : public RtfSink
+{
+    public:
+        RtfMemorySink(Container& target): RtfSink(0), _target(target) {}
+        ~RtfMemorySink() { close(); }
+
+    protected:
+        bool write_raw(const char* data, size_t size)
+        {
+            _target.insert( _target.end(), data, data + size );
+            return true;
+        }
+
+    private:
+        Container&          _target;
+};
+
+typedef RtfMemorySink<std::string>          RtfStringSink;
+typedef RtfMemorySink< std::vector<char> >  RtfVectorSink;
@@ -0,0 +1,141 @@
+/*
+Copyright (c) <year> <copyright holders>
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+//
+// Writes the same document through the FILE*, file descriptor and io_uring
+// sinks and reports the time of each. Linux only, build from the repository root:
+//
+//     g++ -std=c++17 -O2 -I. *.cpp bench/sink_bench.cpp -o sink_bench -lpthread
+//     ./sink_bench [output file] [paragraphs] [runs]
+//
+#include "RtfCpp.h"
+#include <chrono>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Sink kinds
+#define BENCH_SINK_FILE						0
+#define BENCH_SINK_FD						1
+#define BENCH_SINK_POSIX					2
+#define BENCH_SINK_URING					3
+#define BENCH_SINK_COUNT					4
+
+static const char* benchSinkNames[BENCH_SINK_COUNT] = { "RtfFileSink (FILE*)", "RtfFdSink", "RtfPosixSink", "RtfUringSink" };
+
+// Creates sink of given kind writing to path
+static std::unique_ptr<RtfSink> bench_create(int kind, const char* path)
+{
+    if ( kind == BENCH_SINK_FILE )
+    {
+        FILE* file = fopen( path, "wb" );
+        return std::unique_ptr<RtfSink>( file != NULL ? new RtfFileSink(file) : NULL );
+    }
+    if ( kind == BENCH_SINK_FD )
+    {
+        int fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+        return std::unique_ptr<RtfSink>( fd >= 0 ? new RtfFdSink(fd) : NULL );
+    }
+    if ( kind == BENCH_SINK_POSIX )
+        return RtfPosixSink::create( path );
+
+    return RtfUringSink::create( path );
+}
+
+// Writes benchmark document, returns false on error
+static bool bench_document(RtfWriter& writer, int paragraphs)
+{
+    static const char text[] = "Quarterly revenue by region and product line, including returns and adjustments";
+
+    if ( !writer.open( NULL, NULL ) )
+        return false;
+
+    RTF_TABLECELL_FORMAT cells[4];
+    int margins[4];
+    for ( int i=0; i<4; i++ )
+    {
+        memcpy( &cells[i], writer.get_tablecellformat(), sizeof(RTF_TABLECELL_FORMAT) );
+        margins[i] = 2000 * ( i + 1 );
+    }
+    RtfRowTemplate row;
+    writer.compile_tablerow( row, cells, margins, 4 );
+
+    std::string_view values[4] = { "North", "Widgets", "1,234,567.89", "12.5%" };
+    for ( int i=0; i<paragraphs; i++ )
+    {
+        if ( writer.start_paragraph( text, true ) != RTF_SUCCESS )
+            return false;
+        if ( i % 4 == 0 && writer.write_tablerow( row, values ) != RTF_SUCCESS )
+            return false;
+    }
+
+    return writer.reset( std::unique_ptr<RtfSink>() );
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = argc > 1 ? argv[1] : "sink_bench.rtf";
+    int paragraphs = argc > 2 ? atoi( argv[2] ) : 2000000;
+    int runs = argc > 3 ? atoi( argv[3] ) : 5;
+
+    for ( int kind=0; kind<BENCH_SINK_COUNT; kind++ )
+    {
+        double best = 0;
+        long long size = 0;
+        bool fallback = false;
+        for ( int run=0; run<runs; run++ )
+        {
+            std::unique_ptr<RtfSink> sink = bench_create( kind, path );
+            if ( !sink )
+            {
+                fprintf( stderr, "could not create %s\n", path );
+                return 1;
+            }
+            if ( kind == BENCH_SINK_URING && dynamic_cast<RtfUringSink*>( sink.get() ) == NULL )
+                fallback = true;
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            {
+                RtfWriter writer( std::move(sink) );
+                if ( !bench_document( writer, paragraphs ) )
+                {
+                    fprintf( stderr, "%s: write error\n", benchSinkNames[kind] );
+                    return 1;
+                }
+            }
+            double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+            if ( run == 0 || seconds < best )
+                best = seconds;
+
+            struct stat status;
+            if ( stat( path, &status ) == 0 )
+                size = status.st_size;
+        }
+
+        printf( "%-22s %8.1f ms %8.1f MB/s%s\n", benchSinkNames[kind], best * 1000, size / best / 1e6,
+            fallback ? "  (io_uring unavailable, RtfFdSink fallback)" : "" );
+    }
+
+    unlink( path );
+    return 0;
+}
@@ -11,6 +11,83 @@
 #define RTF_TABLE_ERROR				0x0008			// Could not write table to RTF file
 #define RTF_SUCCESS					0x1000			// No error
 
+// Output sink flush policy defs
+#define RTF_FLUSH_BUFFERFULL				0				// Flush when the sink buffer is full or on close
+#define RTF_FLUSH_PARAGRAPH					1				// Flush after every paragraph and table row
+
+// Paragraph text encoding defs
+#define RTF_TEXTENCODING_RAW				0				// Text is written as is and may contain RTF control words
+#define RTF_TEXTENCODING_UTF8				1				// Text is UTF-8, special characters are escaped
+#define RTF_TEXTENCODING_ANSI				2				// Text is in the document code page, only \, { and } are escaped (the default)
+
+// Output sink buffer size (the default is 256 KB)
+#define RTF_SINK_BUFFERSIZE					(256*1024)
+
+// POSIX file sink option defs
+#define RTF_FILEOPTION_DROPCACHE			0x01			// Drop written pages from the page cache
+#define RTF_FILEOPTION_DIRECT				0x02			// Bypass the page cache with O_DIRECT
+
+// O_DIRECT block, buffer and file offset alignment
+#define RTF_DIRECT_ALIGNMENT				4096
+
+// Written bytes kept in the page cache before dropping (the default is 8 MB)
+#define RTF_DROPCACHE_WINDOW				(8*1024*1024)
+
+// Document file backend defs
+#define RTF_FILEBACKEND_DEFAULT				0				// Buffered writes to the file
+#define RTF_FILEBACKEND_MMAP				1				// Memory-mapped file, POSIX only
+#define RTF_FILEBACKEND_ASYNC				2				// Buffered writes on a background I/O thread
+
+// Memory-mapped file growth step (the default is 64 MB)
+#define RTF_MMAP_GROWSTEP					(64*1024*1024)
+
+// Registered buffers of the io_uring sink, each of the sink buffer size
+#define RTF_URING_BUFFERS					4
+
+// Binary bytes per hex line of embedded pictures
+#define RTF_HEXLINE_BYTES					64
+
+// Image file read chunk size (the default is 64 KB)
+#define RTF_IMAGE_READSIZE					(64*1024)
+
+// Encoded image cache budget (the default is 16 MB)
+#define RTF_IMAGECACHE_BUDGET				(16*1024*1024)
+
+// Largest cached image group as a share of the cache budget (the default is 1/8)
+#define RTF_IMAGECACHE_ENTRYSHARE			8
+
+// Image type defs
+#define RTF_IMAGETYPE_NONE					0
+#define RTF_IMAGETYPE_PNG					1
+#define RTF_IMAGETYPE_JPEG					2
+
+// Maximum nesting of push_format groups
+#define RTF_MAX_FORMAT_DEPTH				16
+
+// Table rows formatted per batch by write_table
+#define RTF_TABLE_BATCHROWS					1024
+
+// Maximum length of a formatted number
+#define RTF_NUMBER_MAXLENGTH				512
+
+// Maximum fraction digits of a formatted number
+#define RTF_NUMBER_MAXPRECISION				16
+
+// Table column type defs
+#define RTF_COLUMNTYPE_STRING				0
+#define RTF_COLUMNTYPE_INT64				1
+#define RTF_COLUMNTYPE_DOUBLE				2
+
+// Font family defs
+#define RTF_FONTFAMILY_NIL					0
+#define RTF_FONTFAMILY_ROMAN				1
+#define RTF_FONTFAMILY_SWISS				2
+#define RTF_FONTFAMILY_MODERN				3
+#define RTF_FONTFAMILY_SCRIPT				4
+#define RTF_FONTFAMILY_DECOR				5
+#define RTF_FONTFAMILY_TECH					6
+#define RTF_FONTFAMILY_BIDI					7
+
 // Paragraph break defs
 #define RTF_PARAGRAPHBREAK_NONE				0
 #define RTF_PARAGRAPHBREAK_PAGE				1
@@ -318,3 +395,24 @@ struct RTF_TABLECELL_FORMAT
 	struct RTF_TABLEBORDER_FORMAT borderBottom;		// Cell RTF_TABLEBORDER_FORMAT structure
 };
 
+
+// RTF image info structure
+struct RTF_IMAGE_INFO
+{
+	int imageType;							// Image file type
+	int imageWidth;							// Image width in pixels
+	int imageHeight;						// Image height in pixels
+};
+
+
+// RTF number format structure
+struct RTF_NUMBER_FORMAT
+{
+	int precision;							// Fraction digits up to 16, negative for shortest round-trip form
+	bool thousandsSeparator;				// Group integer digits by thousands
+	char separatorChar;						// Thousands separator (the default is ',')
+	char decimalChar;						// Decimal point (the default is '.')
+	bool percent;							// Value is multiplied by 100 and followed by %
+	bool negativeParentheses;				// Negative values are written in parentheses instead of with a minus sign
+	int decimalTab;							// Decimal tab position in table cell, 0 for no decimal alignment
+};